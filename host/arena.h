@@ -0,0 +1,217 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <dpu>
+#include <dpu.h>
+#include <new>
+#include <sys/mman.h>
+#include <vector>
+
+using namespace dpu;
+
+#define ARENA_LINE 64
+#define ARENA_PAGE 4096UL
+#define ARENA_HUGEPAGE (2UL << 20)
+
+// Slots of one per-DPU buffer, the slot of DPU i is at base + slot[i].
+// Indexing gives a pointer, so code written for nested vectors reads the same
+template <typename T>
+struct ArenaView
+{
+    char *base;
+    const size_t *slot;
+    int n_dpus;
+
+    T *
+    operator[](int i) const
+    {
+        return (T *)(base + slot[i]);
+    }
+
+    int
+    size() const
+    {
+        return n_dpus;
+    }
+};
+
+// One mapping holding a slot per DPU for each of several buffers, buffer after
+// buffer. Slots are cache-line aligned and packed. Within a buffer, the slots
+// of each group of DPUs (a rank) start on a hugepage when they span one, so
+// the group's pages can be first touched from the node of its rank.
+class Arena
+{
+  public:
+    // group_first: index of the first DPU of each group, in increasing order
+    explicit Arena(int n_dpus,
+                   const std::vector<int> &group_first = std::vector<int>(1, 0))
+        : n_dpus(n_dpus), group_first(group_first)
+    {
+        this->group_first.push_back(n_dpus);
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena()
+    {
+        if (base != nullptr)
+        {
+            munmap(base, length);
+        }
+    }
+
+    // Adds a buffer of count T per DPU, its view is valid once mapped
+    template <typename T>
+    int
+    reserve(size_t count)
+    {
+        Buffer buffer;
+
+        buffer.stride = round_up(count * sizeof(T), ARENA_LINE);
+        buffers.push_back(buffer);
+
+        return buffers.size() - 1;
+    }
+
+    // Lays the buffers out, then maps them on hugepages when some are reserved,
+    // transparent hugepages otherwise. An arena under a hugepage takes small
+    // pages instead. Pages are not touched here, see touch()
+    void
+    map()
+    {
+        size_t size = 0;
+
+        for (auto &buffer : buffers)
+        {
+            buffer.slot.resize(n_dpus);
+
+            for (size_t g = 0; g + 1 < group_first.size(); ++g)
+            {
+                size_t bytes = buffer.stride * (group_first[g + 1] - group_first[g]);
+
+                size = round_up(size, (bytes >= ARENA_HUGEPAGE) ? ARENA_HUGEPAGE
+                                                                 : ARENA_LINE);
+                for (int i = group_first[g]; i < group_first[g + 1]; ++i)
+                {
+                    buffer.slot[i] = size + (i - group_first[g]) * buffer.stride;
+                }
+                size += bytes;
+            }
+        }
+
+        bool small = (size < ARENA_HUGEPAGE);
+        void *p = MAP_FAILED;
+
+        length = round_up(size, small ? ARENA_PAGE : ARENA_HUGEPAGE);
+
+        if (!small)
+        {
+            p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        huge = (p != MAP_FAILED);
+
+        if (!huge)
+        {
+            p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+            if (p == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            if (!small)
+            {
+                madvise(p, length, MADV_HUGEPAGE);
+            }
+        }
+
+        base = (char *)p;
+    }
+
+    // Faults in the slots of DPUs [first, first + count) of every buffer
+    void
+    touch(int first, int count)
+    {
+        for (auto &buffer : buffers)
+        {
+            for (int i = first; i < first + count; ++i)
+            {
+                memset(base + buffer.slot[i], 0, buffer.stride);
+            }
+        }
+    }
+
+    template <typename T>
+    ArenaView<T>
+    view(int buffer) const
+    {
+        return {base, buffers[buffer].slot.data(), n_dpus};
+    }
+
+    // Slots [first, first + count) only, indexed from 0
+    template <typename T>
+    ArenaView<T>
+    view(int buffer, int first, int count) const
+    {
+        return {base, buffers[buffer].slot.data() + first, count};
+    }
+
+    size_t
+    bytes() const
+    {
+        return length;
+    }
+
+    bool
+    hugepages() const
+    {
+        return huge;
+    }
+
+  private:
+    struct Buffer
+    {
+        size_t stride;
+        std::vector<size_t> slot;
+    };
+
+    static size_t
+    round_up(size_t n, size_t align)
+    {
+        return (n + align - 1) / align * align;
+    }
+
+    const int n_dpus;
+    std::vector<int> group_first;
+    std::vector<Buffer> buffers;
+    size_t length = 0;
+    char *base = nullptr;
+    bool huge = false;
+};
+
+// Parallel transfer between symbol and the slots [first_dpu, first_dpu + |set|)
+// of view, bytes per DPU. The slots are handed to the SDK as they are, without
+// a staging copy. Errors throw a DpuError, as the C++ API does. With
+// DPU_XFER_ASYNC the transfer is only queued, dpu_sync() waits for it
+template <typename T>
+inline void
+arena_copy(DpuSet &set, dpu_xfer_t direction, const char *symbol,
+           const ArenaView<T> &view, int first_dpu, size_t bytes, size_t offset = 0,
+           dpu_xfer_flags_t flags = DPU_XFER_DEFAULT)
+{
+    struct dpu_set_t dpu;
+    uint32_t i;
+
+    DPU_FOREACH(set.cDpuSet(), dpu, i)
+    {
+        DpuError::throwOnErr(dpu_prepare_xfer(dpu, view[first_dpu + i]));
+    }
+    DpuError::throwOnErr(
+        dpu_push_xfer(set.cDpuSet(), direction, symbol, offset, bytes, flags));
+}
+
+#endif /* _ARENA_H_ */
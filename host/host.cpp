@@ -1,160 +1,646 @@
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
 #include <dpu>
+#include <fcntl.h>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <ostream>
+#include <poll.h>
 #include <random>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_set>
+
+#include "../kmeans/common.h"
+#include "../src/cm.h"
+#include "arena.h"
+#include "topology.h"
+
+// Objects per DPU gathered by each parallel transfer of the export stage
+#define EXPORT_CHUNK 8192
+// Points read at a time from the -f input file
+#define LOAD_CHUNK 65536
+// Auto-tuner: kernel candidates (make tune), iterations timed per candidate
+// and the choices made so far, one line per (K, D, N) shape
+#define TUNE_DIR "kmeans/tune"
+#define TUNE_LOOPS 5
+#define TUNE_CACHE ".kmeans_tune"
+// Mini-batch stopping: weight of the newest sample SSE in its moving average,
+// iterations without an improvement of the tolerance before stopping, and the
+// tolerance when -e is not given
+#define MINIBATCH_EWA 0.2
+#define MINIBATCH_PATIENCE 10
+#define MINIBATCH_TOLERANCE 1e-3
 
 using namespace dpu;
 
+// Settings of one fit
+struct FitConfig
+{
+    int n_clusters;
+    double inertia_threshold;
+    double target_inertia; // Stop as soon as reached, 0 disables
+    double batch_fraction; // Points sampled per DPU and iteration, 1 is full batch
+    bool verbose;
+    long n_objects; // Points stored on the DPUs
+    long n_points;  // Raw points they stand for, the sum of the weights
+    std::int64_t split_leaf; // Bisecting: fit only the points of this leaf, -1 for all
+    int max_loops;           // Stop after this many iterations, 0 for no limit
+    bool reset_leaves;       // Bisecting: the fit also puts every point in leaf 0
+};
+
+// Kernel settings given on the command line (-c, -a, -d), loaded into every
+// set a fit runs on
+struct KernelSettings
+{
+    std::vector<std::uint64_t> cm_policy;
+    std::vector<std::uint64_t> cm_irrevocable_after;
+    std::vector<std::uint64_t> distance_kernel;
+};
+
+// One line of a -j job file: "n_ranks n_clusters [points_file]"
+struct JobSpec
+{
+    int n_ranks;
+    int n_clusters;
+    std::string path; // Generated points if empty
+};
+
+// Outcome of one fit
+struct FitStats
+{
+    int loops;
+    double inertia;
+    double time; // us, from the first center copy to convergence
+    std::uint64_t aborts;
+    double launch_p50; // us, DPU launch times across iterations
+    double launch_p99;
+    double launch_max;
+    double time_to_target; // us, -1 if FitConfig::target_inertia was not reached
+};
+
+// Node of the tree built by bisect(). A leaf is a cluster, an inner node was
+// split in its two children
+struct TreeNode
+{
+    std::vector<float> center;
+    int left; // Children, -1 for a leaf
+    int right;
+    int leaf; // Label of the points of a leaf, -1 for an inner node
+};
+
+// A configuration tried by autotune() and how it fared
+struct TuneResult
+{
+    int n_tasklets;
+    int points_block;
+    int n_dpus;
+    double iteration_time; // us
+    double abort_rate;     // Aborts per transaction
+};
+
+// Outcome of one job, times in us from the start of the queue
+struct JobResult
+{
+    FitStats stats;
+    std::vector<int> ranks; // Indices in system.ranks()
+    int n_dpus;
+    double start;
+    double end;
+    bool ok;
+};
+
+// Per-DPU inputs of a fit, points, weights and point counts, in one arena
+struct InputSlots
+{
+    std::unique_ptr<Arena> arena;
+    ArenaView<float> attributes;
+    ArenaView<std::uint32_t> weights;
+    ArenaView<std::uint64_t> n_objects;
+
+    // Stored point of each input row when -f rows were merged, empty when
+    // points are stored as read
+    std::vector<std::uint32_t> raw_index;
+
+    // Maps the slots, the caller touches them where they should live.
+    // group_first as for Arena
+    void
+    allocate(int n_dpus, const std::vector<int> &group_first = std::vector<int>(1, 0))
+    {
+        arena.reset(new Arena(n_dpus, group_first));
+
+        int a = arena->reserve<float>(NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES);
+#if USE_WEIGHTS
+        int w = arena->reserve<std::uint32_t>(NUM_OBJECTS_PADDED);
+#else
+        int w = arena->reserve<std::uint32_t>(0);
+#endif
+        int n = arena->reserve<std::uint64_t>(1);
+
+        arena->map();
+        attributes = arena->view<float>(a);
+        weights = arena->view<std::uint32_t>(w);
+        n_objects = arena->view<std::uint64_t>(n);
+    }
+
+    // Faults in the slots of DPUs [first, first + count): full DPUs of unit
+    // weight points
+    void
+    touch(int first, int count)
+    {
+        arena->touch(first, count);
+
+        for (int i = first; i < first + count; ++i)
+        {
+#if USE_WEIGHTS
+            std::fill_n(weights[i], NUM_OBJECTS_PADDED, 1);
+#endif
+            n_objects[i][0] = NUM_OBJECTS_PER_DPU;
+        }
+    }
+};
+
+long
+minor_faults();
+
 void
-generate_initial_points(std::vector<std::vector<float>> &attributes);
+bench_buffers();
 
 void
-pick_initial_centers(std::vector<std::vector<float>> &attributes,
-                     std::vector<float> &current_cluster_centers);
+generate_initial_points(const ArenaView<float> &attributes);
 
-int
-main(int argc, char **argv)
-{
-    // IN
-    std::vector<std::vector<float>> attributes(
-        N_DPUS, std::vector<float>(NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES));
+long
+read_input(const std::string &path, std::vector<float> &points,
+           std::vector<std::uint32_t> &counts, std::vector<std::uint32_t> &raw_index);
+
+bool
+spread_points(const std::vector<float> &points, const std::vector<std::uint32_t> &counts,
+              const ArenaView<float> &attributes,
+              const ArenaView<std::uint32_t> &weights,
+              const ArenaView<std::uint64_t> &n_objects);
+
+long
+load_points(const std::string &path, const ArenaView<float> &attributes,
+            const ArenaView<std::uint32_t> &weights,
+            const ArenaView<std::uint64_t> &n_objects,
+            std::vector<std::uint32_t> &raw_index);
+
+bool
+prepare_points(Topology &topology, const std::string &path, InputSlots &inputs,
+               FitConfig &config);
+
+void
+upload_points(Topology &topology, const ArenaView<float> &attributes,
+              const ArenaView<std::uint32_t> &weights,
+              const ArenaView<std::uint64_t> &n_objects);
+
+void
+pick_initial_centers(const ArenaView<float> &attributes,
+                     const ArenaView<std::uint64_t> &n_objects,
+                     std::vector<float> &current_cluster_centers, int n_clusters);
+
+FitStats
+kmeans(Topology &topology, const FitConfig &config,
+       std::vector<float> &current_cluster_centers);
+
+void
+compute_center_norms(const std::vector<float> &current_cluster_centers, int n_clusters,
+                     std::vector<float> &current_cluster_norms);
+
+void
+bench_distance_kernels(DpuSet &system, std::vector<float> &current_cluster_centers,
+                       int n_clusters, const ArenaView<std::uint64_t> &n_objects);
+
+void
+zscore_transform(Topology &topology, long n_points, std::vector<float> &attr_mean,
+                 std::vector<float> &attr_scale);
+
+bool
+read_jobs(const std::string &path, std::vector<JobSpec> &jobs);
+
+void
+run_jobs(DpuSet &system, const std::vector<JobSpec> &jobs, const FitConfig &config,
+         bool serial_pass);
+
+void
+autotune(FitConfig config, const KernelSettings &settings, const std::string &input_path,
+         long n_points);
+
+FitStats
+bisect(Topology &topology, const FitConfig &config, int n_leaves,
+       const ArenaView<float> &attributes,
+       const ArenaView<std::uint64_t> &n_objects,
+       const std::vector<float> &attr_mean, const std::vector<float> &attr_scale,
+       std::vector<TreeNode> &tree);
+
+void
+report_tree_lookup(const std::vector<TreeNode> &tree,
+                   const ArenaView<float> &attributes,
+                   const ArenaView<std::uint64_t> &n_objects,
+                   const std::vector<float> &attr_mean,
+                   const std::vector<float> &attr_scale);
+
+void
+normalize_points(float *points, int n_points, const std::vector<float> &attr_mean,
+                 const std::vector<float> &attr_scale);
+
+void
+denormalize_points(float *points, int n_points, const std::vector<float> &attr_mean,
+                   const std::vector<float> &attr_scale);
 
-    std::vector<float> current_cluster_centers(N_CLUSTERS * NUM_ATTRIBUTES);
+void
+export_results(DpuSet &system, std::vector<float> &current_cluster_centers,
+               int n_clusters, const std::string &prefix,
+               const ArenaView<std::uint64_t> &n_objects,
+               const std::vector<std::uint32_t> &raw_index);
 
-    std::vector<std::uint64_t> init(1, 1);
+void
+serve_predictions(DpuSet &system, std::vector<float> &current_cluster_centers,
+                  const std::vector<float> &attr_mean,
+                  const std::vector<float> &attr_scale, const std::string &source,
+                  const std::string &sink, int batch_size);
 
-    // OUT
-    std::vector<std::vector<float>> round_cluster_centers(
-        N_DPUS, std::vector<float>(N_CLUSTERS * NUM_ATTRIBUTES));
+int
+main(int argc, char **argv)
+{
+    // IN, allocated once the topology is known
+    InputSlots inputs;
 
-    std::vector<std::vector<std::uint32_t>> round_cluster_centers_len(
-        N_DPUS, std::vector<std::uint32_t>(N_CLUSTERS));
+    std::vector<float> current_cluster_centers(MAX_N_CLUSTERS * NUM_ATTRIBUTES);
 
-    std::vector<std::vector<std::uint64_t>> agregated_delta(
-        N_DPUS, std::vector<std::uint64_t>(1, 0));
+    // Identity unless USE_ZSCORE_TRANSFORM, DPU data is in normalized units
+    std::vector<float> attr_mean(NUM_ATTRIBUTES, 0);
+    std::vector<float> attr_scale(NUM_ATTRIBUTES, 1);
 
     // LOCAL
-    std::vector<std::uint32_t> agregated_cluster_centers_len(N_CLUSTERS);
+    FitConfig config = {N_CLUSTERS, INERTIA_THRESHOLD, 0, 1, false, 0, 0, -1, 0, false};
+    FitStats stats;
     double total_time = 0;
     double comm_time = 0;
-    double delta;
-    int loop = 0;
+    double setup_time = 0;
+    bool sweep = false;
+    bool numa_aware = false;
+    bool bench = false;
+    bool bench_host_buffers = false;
+    bool serial_jobs = false;
+    int bisect_k = 0;
+    long tune_points = 0;
+    int restarts = 1;
+    std::string export_prefix;
+    std::string input_path;
+    std::string jobs_path;
+    std::string predict_source;
+    std::string predict_sink = "labels.bin";
+    int predict_batch = N_DPUS * PREDICT_OBJECTS_PER_DPU;
+    std::vector<std::uint64_t> cm_policy(1, CM_POLICY);
+    std::vector<std::uint64_t> cm_irrevocable_after(1, CM_IRREVOCABLE_AFTER);
+    std::vector<std::uint64_t> distance_kernel(1, DISTANCE_KERNEL);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "Aa:b:Bc:d:e:f:j:k:l:m:no:P:r:sSt:T:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'A':
+            bench_host_buffers = true;
+            break;
+        case 'a':
+            cm_irrevocable_after[0] = atoi(optarg);
+            break;
+        case 'B':
+            bench = true;
+            break;
+        case 'c':
+            cm_policy[0] = atoi(optarg);
+            if (cm_policy[0] > CM_IRREVOCABLE)
+            {
+                std::cerr << "Unknown contention manager " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case 'b':
+            predict_batch =
+                std::max(1, std::min(atoi(optarg), N_DPUS * PREDICT_OBJECTS_PER_DPU));
+            break;
+        case 'd':
+            distance_kernel[0] = atoi(optarg);
+            if (distance_kernel[0] >= N_DISTANCE_KERNELS)
+            {
+                std::cerr << "Unknown distance kernel " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case 'e':
+            config.inertia_threshold = atof(optarg);
+            break;
+        case 'f':
+            input_path = optarg;
+            break;
+        case 'j':
+            jobs_path = optarg;
+            break;
+        case 'k':
+            bisect_k = std::max(1, atoi(optarg));
+            break;
+        case 'l':
+            predict_sink = optarg;
+            break;
+        case 'm':
+            config.batch_fraction = atof(optarg);
+            if (config.batch_fraction <= 0 || config.batch_fraction > 1)
+            {
+                std::cerr << "Mini-batch fraction must be in (0, 1]" << std::endl;
+                return 1;
+            }
+            break;
+        case 'n':
+            numa_aware = true;
+            break;
+        case 'o':
+            export_prefix = optarg;
+            break;
+        case 'P':
+            predict_source = optarg;
+            break;
+        case 'r':
+            restarts = std::max(1, atoi(optarg));
+            sweep = true;
+            break;
+        case 's':
+            sweep = true;
+            break;
+        case 'S':
+            serial_jobs = true;
+            break;
+        case 't':
+            config.target_inertia = atof(optarg);
+            break;
+        case 'T':
+            tune_points = std::max(1L, atol(optarg));
+            break;
+        case 'v':
+            config.verbose = true;
+            break;
+        default:
+            std::cerr << "Usage: " << argv[0]
+                      << " [-f points_file] [-e inertia_threshold] [-o export_prefix]"
+                      << " [-v]"
+                      << " [-s] [-r restarts] [-c cm_policy] [-a irrevocable_after] [-n]"
+                      << " [-m batch_fraction] [-t target_inertia] [-d kernel] [-B]"
+                      << " [-P file|-|unix:path [-l labels_file] [-b batch]]"
+                      << " [-j jobs_file [-S]] [-k bisect_clusters] [-T n_points] [-A]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    if (bench_host_buffers)
+    {
+        bench_buffers();
+        return 0;
+    }
 
     try
     {
+        // Allocates its own sets, one per candidate
+        if (tune_points > 0)
+        {
+            KernelSettings settings = {cm_policy, cm_irrevocable_after, distance_kernel};
+
+            autotune(config, settings, input_path, tune_points);
+            return 0;
+        }
+
+        auto start_setup = std::chrono::steady_clock::now();
+
         auto system = DpuSet::allocate(N_DPUS);
 
         system.load("kmeans/kmeans");
 
-        generate_initial_points(attributes);
+        system.copy("cm_policy", cm_policy);
+        system.copy("cm_irrevocable_after", cm_irrevocable_after);
+        system.copy("distance_kernel", distance_kernel);
 
-        auto start = std::chrono::steady_clock::now();
+        // Seeds the per-DPU mini-batch samplers
+        std::vector<std::vector<std::uint64_t>> dpu_id(N_DPUS,
+                                                       std::vector<std::uint64_t>(1));
+        for (int i = 0; i < N_DPUS; ++i)
+        {
+            dpu_id[i][0] = i;
+        }
+        system.copy("dpu_id", dpu_id);
 
-        system.copy("attributes", attributes);
+        if (!jobs_path.empty())
+        {
+            std::vector<JobSpec> jobs;
 
-        system.copy("init", init);
+            if (!read_jobs(jobs_path, jobs))
+            {
+                return 1;
+            }
 
-        auto end_copy = std::chrono::steady_clock::now();
+            run_jobs(system, jobs, config, serial_jobs);
+            return 0;
+        }
 
-        // Rabdomly pick initial centers
-        pick_initial_centers(attributes, current_cluster_centers);
+        Topology topology;
+        build_topology(system, numa_aware, topology);
 
-        do
+        auto end_setup = std::chrono::steady_clock::now();
+
+        setup_time = std::chrono::duration_cast<std::chrono::microseconds>(end_setup -
+                                                                          start_setup)
+                         .count();
+
+        if (!prepare_points(topology, input_path, inputs, config))
         {
-            // IN: Copy current centers
-            system.copy("current_cluster_centers", current_cluster_centers);
+            return 1;
+        }
 
-            // Execute
-            system.exec();
+        auto start = std::chrono::steady_clock::now();
 
-            // system.log(std::cout);
+        upload_points(topology, inputs.attributes, inputs.weights, inputs.n_objects);
 
-            // OUT: Copy (agregated) new centers
-            system.copy(round_cluster_centers, "local_cluster_centers");
+        auto end_copy = std::chrono::steady_clock::now();
 
-            // OUT: Copy centers len
-            system.copy(round_cluster_centers_len, "local_centers_len");
+        comm_time +=
+            std::chrono::duration_cast<std::chrono::microseconds>(end_copy - start).count();
 
-            // OUT: Copy delta
-            system.copy(agregated_delta, "agregated_delta");
+#if USE_ZSCORE_TRANSFORM
+        zscore_transform(topology, config.n_points, attr_mean, attr_scale);
+#endif
 
-            // Compute new centers
-            for (int i = 0; i < N_CLUSTERS * NUM_ATTRIBUTES; ++i)
+        if (bench)
+        {
+            pick_initial_centers(inputs.attributes, inputs.n_objects,
+                                 current_cluster_centers, config.n_clusters);
+            normalize_points(current_cluster_centers.data(), config.n_clusters, attr_mean,
+                             attr_scale);
+
+            bench_distance_kernels(system, current_cluster_centers, config.n_clusters,
+                                   inputs.n_objects);
+            return 0;
+        }
+
+        if (bisect_k > 0)
+        {
+            std::vector<TreeNode> tree;
+
+            stats = bisect(topology, config, bisect_k, inputs.attributes,
+                           inputs.n_objects, attr_mean, attr_scale, tree);
+
+            std::cout << "MODE\tK\tLOOPS\tINERTIA\tFIT_TIME" << std::endl;
+            std::cout << "bisect\t" << (tree.size() + 1) / 2 << "\t" << stats.loops
+                      << "\t" << stats.inertia << "\t" << stats.time << std::endl;
+
+            // Flat k-means at the same K, on the same data, when the build allows it
+            if (bisect_k <= MAX_N_CLUSTERS)
             {
-                current_cluster_centers[i] = 0;
+                config.n_clusters = bisect_k;
+                pick_initial_centers(inputs.attributes, inputs.n_objects,
+                                     current_cluster_centers, bisect_k);
+                normalize_points(current_cluster_centers.data(), bisect_k, attr_mean,
+                                 attr_scale);
+
+                stats = kmeans(topology, config, current_cluster_centers);
+
+                std::cout << "flat\t" << bisect_k << "\t" << stats.loops << "\t"
+                          << stats.inertia << "\t" << stats.time << std::endl;
             }
 
-            for (int i = 0; i < N_CLUSTERS; ++i)
+            report_tree_lookup(tree, inputs.attributes, inputs.n_objects, attr_mean,
+                               attr_scale);
+            return 0;
+        }
+
+        if (!sweep)
+        {
+            // Rabdomly pick initial centers
+            pick_initial_centers(inputs.attributes, inputs.n_objects,
+                                 current_cluster_centers, config.n_clusters);
+            normalize_points(current_cluster_centers.data(), config.n_clusters, attr_mean,
+                             attr_scale);
+
+            stats = kmeans(topology, config, current_cluster_centers);
+
+            auto end = std::chrono::steady_clock::now();
+
+            total_time +=
+                std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+            std::cout << NR_TASKLETS << "\t" 
+                      << N_DPUS << "\t" 
+                      << stats.loops << "\t"
+                      << config.n_objects * stats.loops  << "\t" 
+                      << comm_time << "\t" 
+                      << total_time << "\t"
+                      << stats.inertia << "\t"
+                      << cm_policy[0] << "\t"
+                      << stats.aborts << "\t"
+                      << stats.launch_p50 << "\t"
+                      << stats.launch_p99 << "\t"
+                      << stats.launch_max << std::endl;
+
+            // Bytes per microsecond is MB/s
+            std::cerr << (numa_aware ? "numa" : "flat") << ": "
+                      << topology.groups.size() << " groups on "
+                      << std::max<size_t>(topology.workers.size(), 1) << " nodes, upload "
+                      << (double)N_DPUS * NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES *
+                             sizeof(float) / comm_time
+                      << " MB/s, " << stats.time / stats.loops << " us/iteration"
+                      << std::endl;
+
+            if (config.target_inertia > 0)
             {
-                agregated_cluster_centers_len[i] = 0;
+                std::cerr << (config.batch_fraction < 1 ? "mini-batch " : "full-batch ")
+                          << config.batch_fraction << ": time to inertia "
+                          << config.target_inertia << " "
+                          << stats.time_to_target << " us" << std::endl;
             }
+        }
+        else
+        {
+            // The data stays in MRAM, every fit only resets the memberships
+            double fits_time = 0;
+            int n_fits = 0;
 
-            for (int j = 0; j < N_CLUSTERS; ++j)
+            std::cout << "K\tBEST_INERTIA\tMEAN_LOOPS\tFIT_TIME" << std::endl;
+
+            for (int k = MIN_N_CLUSTERS; k <= MAX_N_CLUSTERS; ++k)
             {
-                for (int i = 0; i < N_DPUS; ++i)
+                double best_inertia = -1;
+                double k_time = 0;
+                int k_loops = 0;
+
+                config.n_clusters = k;
+
+                for (int r = 0; r < restarts; ++r)
                 {
-                    for (int c = 0; c < NUM_ATTRIBUTES; ++c)
+                    pick_initial_centers(inputs.attributes, inputs.n_objects,
+                                         current_cluster_centers, k);
+                    normalize_points(current_cluster_centers.data(), k, attr_mean,
+                                     attr_scale);
+
+                    stats = kmeans(topology, config, current_cluster_centers);
+
+                    if (best_inertia < 0 || stats.inertia < best_inertia)
                     {
-                        current_cluster_centers[(j * NUM_ATTRIBUTES) + c] +=
-                            round_cluster_centers[i][(j * NUM_ATTRIBUTES) + c];
+                        best_inertia = stats.inertia;
                     }
-                    agregated_cluster_centers_len[j] += round_cluster_centers_len[i][j];
-                }
-            }
-
-            for (int i = 0; i < N_CLUSTERS; ++i)
-            {
-                if (agregated_cluster_centers_len[i] == 0)
-                {
-                    continue;
+                    k_time += stats.time;
+                    k_loops += stats.loops;
+                    n_fits++;
                 }
+                fits_time += k_time;
 
-                for (int j = 0; j < NUM_ATTRIBUTES; ++j)
-                {
-                    current_cluster_centers[(i * NUM_ATTRIBUTES) + j] /=
-                        agregated_cluster_centers_len[i];
-                }
+                std::cout << k << "\t" << best_inertia << "\t"
+                          << (double)k_loops / restarts << "\t" << k_time << std::endl;
             }
 
-            delta = 0;
-            for (int i = 0; i < N_DPUS; ++i)
-            {
-                delta += agregated_delta[i][0];
-            }
-            delta /= (NUM_OBJECTS_PER_DPU * N_DPUS);
-            // std::cout << delta << std::endl;
+            auto end = std::chrono::steady_clock::now();
 
-        } while ((loop++ < 500) && (delta > THRESHOLD));
-        // } while (0);
-        
-        // for (int i = 0; i < N_CLUSTERS; ++i)
-        // {
-        //     for (int j = 0; j < NUM_ATTRIBUTES; ++j)
-        //     {
-        //         std::cout << current_cluster_centers[(i * NUM_ATTRIBUTES) + j]
-        //                   << ", ";
-        //     }
-        //     std::cout << "-> " << agregated_cluster_centers_len[i] << std::endl;
-        // }
+            total_time +=
+                std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
 
-        auto end = std::chrono::steady_clock::now();
+            // Rebuilding and rerunning pays allocation, load and upload per fit
+            // (compilation not included)
+            std::cout << "# " << n_fits << " fits, sweep " << total_time
+                      << " us, rebuild-and-rerun estimate "
+                      << fits_time + n_fits * (setup_time + comm_time) << " us" << std::endl;
+        }
 
-        total_time +=
-            std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        // After a sweep these apply to the last fit, whose memberships are on the DPUs
+        if (!export_prefix.empty())
+        {
+            // Centers are exported in the original units
+            std::vector<float> centers(current_cluster_centers);
+            denormalize_points(centers.data(), config.n_clusters, attr_mean, attr_scale);
 
-        comm_time +=
-            std::chrono::duration_cast<std::chrono::microseconds>(end_copy - start).count();
+            export_results(system, centers, config.n_clusters, export_prefix,
+                           inputs.n_objects, inputs.raw_index);
+        }
 
-        std::cout << "11" << "\t" 
-                  << N_DPUS << "\t" 
-                  << loop << "\t"
-                  << N_DPUS * NUM_OBJECTS_PER_DPU * loop  << "\t" 
-                  << comm_time << "\t" 
-                  << total_time << std::endl;
+        if (!predict_source.empty())
+        {
+            serve_predictions(system, current_cluster_centers, attr_mean, attr_scale,
+                              predict_source, predict_sink, predict_batch);
+        }
     }
     catch (const DpuError &e)
     {
@@ -164,63 +650,2169 @@ main(int argc, char **argv)
     return 0;
 }
 
-void
-generate_initial_points(std::vector<std::vector<float>> &attributes)
+FitStats
+kmeans(Topology &topology, const FitConfig &config,
+       std::vector<float> &current_cluster_centers)
 {
-    float tmp_centers[GENERATE_N_CENTERS][NUM_ATTRIBUTES];
-    float sigma;
-    int tmp_center;
+    // IN
+    std::uint64_t reset = INIT_MEMBERSHIP | (config.reset_leaves ? INIT_LEAVES : 0);
+    std::vector<std::uint64_t> init(1, (config.split_leaf < 0) ? reset : 0);
+    std::vector<std::int64_t> split_leaf(1, config.split_leaf);
+    std::vector<std::uint64_t> n_clusters(1, config.n_clusters);
+    std::vector<float> current_cluster_norms(N_CLUSTERS_PADDED);
 
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<> f_rand(0, 1);
-    std::uniform_int_distribution<std::mt19937::result_type> d_rand(
-        0, GENERATE_N_CENTERS - 1);
+    // Mini-batch, DPUs sample from the points they hold
+    double objects_per_dpu = (double)config.n_objects / topology.n_dpus();
+    bool mini_batch = config.batch_fraction < 1;
+    std::vector<std::uint64_t> batch_size(
+        1, mini_batch ? std::max(1.0, config.batch_fraction * objects_per_dpu) : 0);
+    std::vector<std::uint64_t> batch_seed(1);
+    std::vector<float> batch_sums(MAX_N_CLUSTERS * NUM_ATTRIBUTES);
+    std::vector<double> center_counts(MAX_N_CLUSTERS, 0);
+    std::mt19937_64 rng(std::random_device{}());
 
-    sigma = pow(((float)1 / GENERATE_N_CENTERS), 3);
-    std::normal_distribution<> normal_dist(0, sigma);
+    // LOCAL
+    std::vector<std::uint64_t> agregated_cluster_centers_len(MAX_N_CLUSTERS);
+    std::vector<double> launch_times;
+    double time_to_target = -1;
+    std::uint64_t aborts = 0;
+    double delta;
+    double inertia = 0;
+    double prev_inertia = 0;
+    double smoothed_inertia = 0;
+    double best_smoothed = 0;
+    double tolerance =
+        (config.inertia_threshold > 0) ? config.inertia_threshold : MINIBATCH_TOLERANCE;
+    int stale = 0;
+    bool inertia_converged = false;
+    int loop = 0;
 
-    for (int i = 0; i < GENERATE_N_CENTERS; ++i)
+    auto start = std::chrono::steady_clock::now();
+
+    // Resets the memberships left by a previous fit, a split resets those of its
+    // points itself
+    topology.copy("init", init);
+
+    topology.copy("split_leaf", split_leaf);
+
+    topology.copy("n_clusters", n_clusters);
+
+    topology.copy("batch_size", batch_size);
+
+    do
     {
-        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        if (mini_batch)
         {
-            tmp_centers[i][j] = f_rand(rng);
+            batch_seed[0] = rng();
+            topology.copy("batch_seed", batch_seed);
         }
-    }
 
-    for (int i = 0; i < N_DPUS; ++i)
-    {
-        for (int c = 0; c < NUM_OBJECTS_PER_DPU; ++c)
+        // IN: Copy current centers and their squared norms
+        compute_center_norms(current_cluster_centers, config.n_clusters,
+                             current_cluster_norms);
+
+        // Queued on every rank of a node before waiting for any
+        topology.for_each_node([&](std::vector<DpuGroup *> &node) {
+            for (DpuGroup *group : node)
+            {
+                DpuError::throwOnErr(dpu_broadcast_to(
+                    group->set->cDpuSet(), "current_cluster_centers", 0,
+                    current_cluster_centers.data(),
+                    current_cluster_centers.size() * sizeof(float), DPU_XFER_ASYNC));
+                DpuError::throwOnErr(dpu_broadcast_to(
+                    group->set->cDpuSet(), "current_cluster_norms", 0,
+                    current_cluster_norms.data(),
+                    current_cluster_norms.size() * sizeof(float), DPU_XFER_ASYNC));
+            }
+            sync_groups(node);
+        });
+
+        // Execute
+        auto start_exec = std::chrono::steady_clock::now();
+
+        topology.exec();
+
+        auto end_exec = std::chrono::steady_clock::now();
+        launch_times.push_back(
+            std::chrono::duration_cast<std::chrono::microseconds>(end_exec - start_exec)
+                .count());
+
+        // system.log(std::cout);
+
+        // OUT: each node queues the gathers of all its ranks, waits once, then
+        // reduces its own DPUs
+        topology.for_each_node([&](std::vector<DpuGroup *> &node) {
+            for (DpuGroup *g : node)
+            {
+                DpuGroup &group = *g;
+
+                // OUT: Copy (agregated) new centers
+                arena_copy(*group.set, DPU_XFER_FROM_DPU, "local_cluster_centers",
+                           group.round_cluster_centers, 0,
+                           MAX_N_CLUSTERS * NUM_ATTRIBUTES * sizeof(float), 0,
+                           DPU_XFER_ASYNC);
+
+                // OUT: Copy centers len
+                arena_copy(*group.set, DPU_XFER_FROM_DPU, "local_centers_len",
+                           group.round_cluster_centers_len, 0,
+                           N_CLUSTERS_PADDED * sizeof(std::uint32_t), 0, DPU_XFER_ASYNC);
+
+                // OUT: Copy delta
+                arena_copy(*group.set, DPU_XFER_FROM_DPU, "agregated_delta",
+                           group.agregated_delta, 0, sizeof(std::uint64_t), 0,
+                           DPU_XFER_ASYNC);
+
+                // OUT: Copy SSE of the assignment against the current centers
+                arena_copy(*group.set, DPU_XFER_FROM_DPU, "agregated_inertia",
+                           group.agregated_inertia, 0, sizeof(double), 0, DPU_XFER_ASYNC);
+
+                // OUT: Copy aborted transactions
+                arena_copy(*group.set, DPU_XFER_FROM_DPU, "agregated_aborts",
+                           group.agregated_aborts, 0, sizeof(std::uint64_t), 0,
+                           DPU_XFER_ASYNC);
+            }
+            sync_groups(node);
+
+            for (DpuGroup *g : node)
+            {
+                DpuGroup &group = *g;
+
+                std::fill(group.sum_centers.begin(), group.sum_centers.end(), 0);
+                std::fill(group.sum_centers_len.begin(), group.sum_centers_len.end(), 0);
+                group.delta = 0;
+                group.inertia = 0;
+                group.aborts = 0;
+
+                for (int i = 0; i < group.n_dpus; ++i)
+                {
+                    for (int j = 0; j < config.n_clusters * NUM_ATTRIBUTES; ++j)
+                    {
+                        group.sum_centers[j] += group.round_cluster_centers[i][j];
+                    }
+                    for (int j = 0; j < config.n_clusters; ++j)
+                    {
+                        group.sum_centers_len[j] += group.round_cluster_centers_len[i][j];
+                    }
+                    group.delta += group.agregated_delta[i][0];
+                    group.inertia += group.agregated_inertia[i][0];
+                    group.aborts += group.agregated_aborts[i][0];
+                }
+            }
+        });
+
+        prev_inertia = inertia;
+        inertia = 0;
+        delta = 0;
+
+        for (int i = 0; i < config.n_clusters; ++i)
         {
-            tmp_center = d_rand(rng);
-            for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+            agregated_cluster_centers_len[i] = 0;
+        }
+
+        if (!mini_batch)
+        {
+            // Compute new centers
+            for (int i = 0; i < config.n_clusters * NUM_ATTRIBUTES; ++i)
             {
-                attributes[i][(c * NUM_ATTRIBUTES) + j] =
-                    tmp_centers[tmp_center][j] + normal_dist(rng);
+                current_cluster_centers[i] = 0;
             }
         }
-    }
-}
+        else
+        {
+            std::fill(batch_sums.begin(), batch_sums.end(), 0);
+        }
 
-void
-pick_initial_centers(std::vector<std::vector<float>> &attributes,
-                     std::vector<float> &current_cluster_centers)
-{
-    int dpu, point;
+        std::vector<float> &sums = mini_batch ? batch_sums : current_cluster_centers;
 
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_int_distribution<> d_rand_dpu(0, N_DPUS - 1);
-    std::uniform_int_distribution<> d_rand_point(0, NUM_OBJECTS_PER_DPU - 1);
+        for (auto &group : topology.groups)
+        {
+            for (int j = 0; j < config.n_clusters * NUM_ATTRIBUTES; ++j)
+            {
+                sums[j] += group.sum_centers[j];
+            }
+            for (int j = 0; j < config.n_clusters; ++j)
+            {
+                agregated_cluster_centers_len[j] += group.sum_centers_len[j];
+            }
+            delta += group.delta;
+            inertia += group.inertia;
+            aborts += group.aborts;
+        }
 
-    for (int i = 0; i < N_CLUSTERS; ++i)
-    {
-        dpu = d_rand_dpu(rng);
-        point = d_rand_point(rng);
-        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        for (int i = 0; i < config.n_clusters; ++i)
         {
-            current_cluster_centers[(i * NUM_ATTRIBUTES) + j] =
-                attributes[dpu][(point * NUM_ATTRIBUTES) + j];
+            if (agregated_cluster_centers_len[i] == 0)
+            {
+                continue;
+            }
+
+            if (!mini_batch)
+            {
+                for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+                {
+                    current_cluster_centers[(i * NUM_ATTRIBUTES) + j] /=
+                        agregated_cluster_centers_len[i];
+                }
+                continue;
+            }
+
+            // Per-center learning rate: the center is the running mean of
+            // every point ever assigned to it
+            center_counts[i] += agregated_cluster_centers_len[i];
+            double eta = agregated_cluster_centers_len[i] / center_counts[i];
+
+            for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+            {
+                float batch_mean =
+                    batch_sums[(i * NUM_ATTRIBUTES) + j] / agregated_cluster_centers_len[i];
+
+                current_cluster_centers[(i * NUM_ATTRIBUTES) + j] +=
+                    eta * (batch_mean - current_cluster_centers[(i * NUM_ATTRIBUTES) + j]);
+            }
         }
-    }
+
+        if (mini_batch)
+        {
+            // Extrapolate the sample SSE, the delta rule does not apply
+            inertia *= objects_per_dpu / batch_size[0];
+            delta = THRESHOLD + 1;
+        }
+        else
+        {
+            delta /= config.n_points;
+        }
+        // std::cout << delta << std::endl;
+
+        // Stop once the relative SSE improvement flattens out
+        inertia_converged = !mini_batch && (loop > 0) && (config.inertia_threshold > 0) &&
+                            ((prev_inertia - inertia) <= config.inertia_threshold * prev_inertia);
+
+        // Sample SSEs are noisy: a mini-batch fit stops once their moving average
+        // has not improved by the tolerance for MINIBATCH_PATIENCE iterations
+        if (mini_batch)
+        {
+            smoothed_inertia = (loop == 0) ? inertia
+                                           : MINIBATCH_EWA * inertia +
+                                                 (1 - MINIBATCH_EWA) * smoothed_inertia;
+            if (loop == 0 || smoothed_inertia < best_smoothed * (1 - tolerance))
+            {
+                best_smoothed = smoothed_inertia;
+                stale = 0;
+            }
+            else if (++stale >= MINIBATCH_PATIENCE)
+            {
+                inertia_converged = true;
+            }
+        }
+
+        if (config.target_inertia > 0 && inertia <= config.target_inertia)
+        {
+            auto now = std::chrono::steady_clock::now();
+            time_to_target =
+                std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+            inertia_converged = true;
+        }
+
+        if (config.verbose)
+        {
+            std::cerr << "K " << config.n_clusters << "\tloop " << loop << "\tdelta "
+                      << delta << "\tinertia " << inertia << std::endl;
+        }
+
+    } while ((loop++ < 500) && (config.max_loops == 0 || loop < config.max_loops) &&
+             (delta > THRESHOLD) && !inertia_converged);
+    // } while (0);
+
+    // for (int i = 0; i < config.n_clusters; ++i)
+    // {
+    //     for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+    //     {
+    //         std::cout << current_cluster_centers[(i * NUM_ATTRIBUTES) + j]
+    //                   << ", ";
+    //     }
+    //     std::cout << "-> " << agregated_cluster_centers_len[i] << std::endl;
+    // }
+
+    // Memberships are only fresh for the last sample: one full batch launch
+    // against the final centers labels every point, and replaces the
+    // extrapolated SSE by the exact one
+    if (mini_batch)
+    {
+        batch_size[0] = 0;
+        topology.copy("batch_size", batch_size);
+
+        compute_center_norms(current_cluster_centers, config.n_clusters,
+                             current_cluster_norms);
+        topology.copy("current_cluster_centers", current_cluster_centers);
+        topology.copy("current_cluster_norms", current_cluster_norms);
+
+        topology.exec();
+
+        topology.for_each_group([&](DpuGroup &group) {
+            arena_copy(*group.set, DPU_XFER_FROM_DPU, "agregated_inertia",
+                       group.agregated_inertia, 0, sizeof(double));
+
+            group.inertia = 0;
+            for (int i = 0; i < group.n_dpus; ++i)
+            {
+                group.inertia += group.agregated_inertia[i][0];
+            }
+        });
+
+        inertia = 0;
+        for (auto &group : topology.groups)
+        {
+            inertia += group.inertia;
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    // A launch lasts as long as its slowest tasklet, so the tail is what matters
+    std::sort(launch_times.begin(), launch_times.end());
+
+    return {loop,
+            inertia,
+            (double)std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+                .count(),
+            aborts,
+            launch_times[launch_times.size() / 2],
+            launch_times[(launch_times.size() * 99) / 100],
+            launch_times.back(),
+            time_to_target};
+}
+
+void
+compute_center_norms(const std::vector<float> &current_cluster_centers, int n_clusters,
+                     std::vector<float> &current_cluster_norms)
+{
+    for (int i = 0; i < n_clusters; ++i)
+    {
+        float norm = 0;
+
+        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        {
+            float x = current_cluster_centers[(i * NUM_ATTRIBUTES) + j];
+            norm += x * x;
+        }
+        current_cluster_norms[i] = norm;
+    }
+}
+
+// Times the assignment step alone with each distance kernel, against the same
+// centers and the full data set
+void
+bench_distance_kernels(DpuSet &system, std::vector<float> &current_cluster_centers,
+                       int n_clusters, const ArenaView<std::uint64_t> &n_objects)
+{
+    std::vector<std::uint64_t> mode(1, MODE_BENCH);
+    std::vector<std::uint64_t> n_clusters_in(1, n_clusters);
+    std::vector<std::uint64_t> batch_size(1, 0);
+    std::vector<std::uint64_t> distance_kernel(1);
+    std::vector<float> current_cluster_norms(N_CLUSTERS_PADDED);
+    std::vector<std::vector<std::uint64_t>> bench_cycles(N_DPUS,
+                                                         std::vector<std::uint64_t>(1));
+    static const char *names[N_DISTANCE_KERNELS] = {"baseline", "partial", "dot"};
+
+    compute_center_norms(current_cluster_centers, n_clusters, current_cluster_norms);
+
+    system.copy("current_cluster_centers", current_cluster_centers);
+    system.copy("current_cluster_norms", current_cluster_norms);
+    system.copy("n_clusters", n_clusters_in);
+    system.copy("batch_size", batch_size);
+    system.copy("mode", mode);
+
+    std::cout << "KERNEL\tCYCLES\tCYCLES_PER_PAIR\tTIME" << std::endl;
+
+    for (int k = 0; k < N_DISTANCE_KERNELS; ++k)
+    {
+        std::uint64_t max_cycles = 0;
+        std::uint64_t slowest_objects = 1;
+
+        distance_kernel[0] = k;
+        system.copy("distance_kernel", distance_kernel);
+
+        auto start = std::chrono::steady_clock::now();
+
+        system.exec();
+
+        auto end = std::chrono::steady_clock::now();
+        double time =
+            std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+        // The slowest DPU bounds the launch
+        system.copy(bench_cycles, "bench_cycles");
+        for (int i = 0; i < N_DPUS; ++i)
+        {
+            if (bench_cycles[i][0] > max_cycles)
+            {
+                max_cycles = bench_cycles[i][0];
+                slowest_objects = std::max<std::uint64_t>(1, n_objects[i][0]);
+            }
+        }
+
+        // Pairs of the slowest DPU, with -f it may hold fewer points than it can
+        std::cout << names[k] << "\t" << max_cycles << "\t"
+                  << (double)max_cycles / ((double)slowest_objects * n_clusters)
+                  << "\t" << time << std::endl;
+    }
+
+    mode[0] = MODE_FIT;
+    system.copy("mode", mode);
+}
+
+void
+zscore_transform(Topology &topology, long n_points, std::vector<float> &attr_mean,
+                 std::vector<float> &attr_scale)
+{
+    std::vector<std::uint64_t> mode(1, MODE_STATS);
+    std::vector<double> sum(NUM_ATTRIBUTES, 0);
+    std::vector<double> sumsq(NUM_ATTRIBUTES, 0);
+    std::mutex mutex;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Pass 1: per-DPU sums over the resident slices
+    topology.copy("mode", mode);
+    topology.exec();
+
+    topology.for_each_group([&](DpuGroup &group) {
+        std::vector<std::vector<double>> attr_sum(group.n_dpus,
+                                                  std::vector<double>(NUM_ATTRIBUTES));
+        std::vector<std::vector<double>> attr_sumsq(group.n_dpus,
+                                                    std::vector<double>(NUM_ATTRIBUTES));
+
+        group.set->copy(attr_sum, "attr_sum");
+        group.set->copy(attr_sumsq, "attr_sumsq");
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < group.n_dpus; ++i)
+        {
+            for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+            {
+                sum[j] += attr_sum[i][j];
+                sumsq[j] += attr_sumsq[i][j];
+            }
+        }
+    });
+
+    for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+    {
+        double mean = sum[j] / n_points;
+        double std_dev = sqrt(std::max(sumsq[j] / n_points - mean * mean, 0.0));
+
+        attr_mean[j] = mean;
+        // A constant dimension is only centered
+        attr_scale[j] = (std_dev > 0) ? 1 / std_dev : 1;
+    }
+
+    // Pass 2: in-place transform
+    mode[0] = MODE_ZSCORE;
+    topology.copy("attr_mean", attr_mean);
+    topology.copy("attr_scale", attr_scale);
+    topology.copy("mode", mode);
+    topology.exec();
+
+    mode[0] = MODE_FIT;
+    topology.copy("mode", mode);
+
+    auto end = std::chrono::steady_clock::now();
+
+    std::cerr << "zscore: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()
+              << " us" << std::endl;
+}
+
+void
+normalize_points(float *points, int n_points, const std::vector<float> &attr_mean,
+                 const std::vector<float> &attr_scale)
+{
+    for (int i = 0; i < n_points; ++i)
+    {
+        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        {
+            points[(i * NUM_ATTRIBUTES) + j] =
+                (points[(i * NUM_ATTRIBUTES) + j] - attr_mean[j]) * attr_scale[j];
+        }
+    }
+}
+
+void
+denormalize_points(float *points, int n_points, const std::vector<float> &attr_mean,
+                   const std::vector<float> &attr_scale)
+{
+    for (int i = 0; i < n_points; ++i)
+    {
+        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        {
+            points[(i * NUM_ATTRIBUTES) + j] =
+                points[(i * NUM_ATTRIBUTES) + j] / attr_scale[j] + attr_mean[j];
+        }
+    }
+}
+
+void
+generate_initial_points(const ArenaView<float> &attributes)
+{
+    float tmp_centers[GENERATE_N_CENTERS][NUM_ATTRIBUTES];
+    float sigma;
+    int tmp_center;
+
+    std::random_device dev;
+    std::mt19937 rng(dev());
+    std::uniform_real_distribution<> f_rand(0, 1);
+    std::uniform_int_distribution<std::mt19937::result_type> d_rand(
+        0, GENERATE_N_CENTERS - 1);
+
+    sigma = pow(((float)1 / GENERATE_N_CENTERS), 3);
+    std::normal_distribution<> normal_dist(0, sigma);
+
+    for (int i = 0; i < GENERATE_N_CENTERS; ++i)
+    {
+        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        {
+            tmp_centers[i][j] = f_rand(rng);
+        }
+    }
+
+    for (int i = 0; i < attributes.size(); ++i)
+    {
+        for (int c = 0; c < NUM_OBJECTS_PER_DPU; ++c)
+        {
+            tmp_center = d_rand(rng);
+            for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+            {
+                attributes[i][(c * NUM_ATTRIBUTES) + j] =
+                    tmp_centers[tmp_center][j] + normal_dist(rng);
+            }
+        }
+    }
+}
+
+void
+pick_initial_centers(const ArenaView<float> &attributes,
+                     const ArenaView<std::uint64_t> &n_objects,
+                     std::vector<float> &current_cluster_centers, int n_clusters)
+{
+    int dpu, point;
+
+    std::random_device dev;
+    std::mt19937 rng(dev());
+    std::uniform_int_distribution<> d_rand_dpu(0, attributes.size() - 1);
+
+    for (int i = 0; i < n_clusters; ++i)
+    {
+        // Only stored points, a DPU may hold fewer than NUM_OBJECTS_PER_DPU
+        do
+        {
+            dpu = d_rand_dpu(rng);
+        } while (n_objects[dpu][0] == 0);
+        point = std::uniform_int_distribution<>(0, n_objects[dpu][0] - 1)(rng);
+        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        {
+            current_cluster_centers[(i * NUM_ATTRIBUTES) + j] =
+                attributes[dpu][(point * NUM_ATTRIBUTES) + j];
+        }
+    }
+}
+
+static bool
+write_all(int fd, const void *buf, size_t size, off_t offset)
+{
+    const char *p = (const char *)buf;
+
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+// Writes a NPY v1.0 header and returns its size (the offset of the data)
+static off_t
+write_npy_header(int fd, const char *descr, const std::string &shape)
+{
+    std::string header = std::string("{'descr': '") + descr +
+                         "', 'fortran_order': False, 'shape': (" + shape + "), }";
+    size_t total = 10 + header.size() + 1;
+
+    // Data has to start on a 64 byte boundary, the header ends with a newline
+    header.append((64 - total % 64) % 64, ' ');
+    header += '\n';
+
+    char preamble[10] = {'\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0};
+    preamble[8] = header.size() & 0xFF;
+    preamble[9] = (header.size() >> 8) & 0xFF;
+
+    if (!write_all(fd, preamble, sizeof(preamble), 0) ||
+        !write_all(fd, header.data(), header.size(), sizeof(preamble)))
+    {
+        return -1;
+    }
+
+    return sizeof(preamble) + header.size();
+}
+
+void
+export_results(DpuSet &system, std::vector<float> &current_cluster_centers,
+               int n_clusters, const std::string &prefix,
+               const ArenaView<std::uint64_t> &n_objects,
+               const std::vector<std::uint32_t> &raw_index)
+{
+    // Only one chunk of memberships per DPU is ever held on the host
+    Arena arena(N_DPUS);
+    int m = arena.reserve<std::uint64_t>(EXPORT_CHUNK);
+    std::vector<std::int32_t> labels(EXPORT_CHUNK);
+    // Points of DPU i are stored after those of DPU i - 1
+    std::vector<long> first_point(N_DPUS + 1, 0);
+    std::uint64_t max_objects = 0;
+    double xfer_time = 0;
+    off_t data_offset;
+    int fd;
+
+    for (int i = 0; i < N_DPUS; ++i)
+    {
+        first_point[i + 1] = first_point[i] + n_objects[i][0];
+        max_objects = std::max(max_objects, n_objects[i][0]);
+    }
+
+    arena.map();
+    arena.touch(0, N_DPUS);
+    ArenaView<std::uint64_t> membership = arena.view<std::uint64_t>(m);
+
+    long n_stored = first_point[N_DPUS];
+    long n_rows = raw_index.empty() ? n_stored : (long)raw_index.size();
+
+    // Merged rows share their point's label, which is only known once every
+    // point has been gathered
+    std::vector<std::int32_t> point_labels(raw_index.empty() ? 0 : n_stored);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::string path = prefix + "_centers.npy";
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    data_offset = write_npy_header(fd, "<f4", std::to_string(n_clusters) + ", " +
+                                                  std::to_string(NUM_ATTRIBUTES));
+    if (fd < 0 || data_offset < 0 ||
+        !write_all(fd, current_cluster_centers.data(),
+                   (size_t)n_clusters * NUM_ATTRIBUTES * sizeof(float), data_offset))
+    {
+        std::cerr << "Failed to write " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return;
+    }
+    close(fd);
+
+    path = prefix + "_labels.npy";
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    data_offset = write_npy_header(fd, "<i4", std::to_string(n_rows) + ",");
+    if (fd < 0 || data_offset < 0)
+    {
+        std::cerr << "Failed to write " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return;
+    }
+
+    for (int first = 0; first < (int)max_objects; first += EXPORT_CHUNK)
+    {
+        int count = std::min(EXPORT_CHUNK, (int)max_objects - first);
+
+        auto start_xfer = std::chrono::steady_clock::now();
+
+        arena_copy(system, DPU_XFER_FROM_DPU, "membership", membership, 0,
+                   count * sizeof(std::uint64_t), first * sizeof(std::uint64_t));
+
+        auto end_xfer = std::chrono::steady_clock::now();
+        xfer_time +=
+            std::chrono::duration_cast<std::chrono::microseconds>(end_xfer - start_xfer)
+                .count();
+
+        for (int i = 0; i < N_DPUS; ++i)
+        {
+            // Slots past the DPU's points hold no label
+            int n = std::min<long>(count, (long)n_objects[i][0] - first);
+
+            if (n <= 0)
+            {
+                continue;
+            }
+
+            if (!raw_index.empty())
+            {
+                for (int c = 0; c < n; ++c)
+                {
+                    point_labels[first_point[i] + first + c] =
+                        (std::int32_t)membership[i][c];
+                }
+                continue;
+            }
+
+            for (int c = 0; c < n; ++c)
+            {
+                labels[c] = (std::int32_t)membership[i][c];
+            }
+
+            if (!write_all(fd, labels.data(), n * sizeof(std::int32_t),
+                           data_offset +
+                               (off_t)(first_point[i] + first) * sizeof(std::int32_t)))
+            {
+                std::cerr << "Failed to write " << path << ": " << strerror(errno)
+                          << std::endl;
+                close(fd);
+                return;
+            }
+        }
+    }
+
+    // One label per input row, in input order
+    for (long first = 0; first < (long)raw_index.size(); first += EXPORT_CHUNK)
+    {
+        int count = std::min<long>(EXPORT_CHUNK, raw_index.size() - first);
+
+        for (int c = 0; c < count; ++c)
+        {
+            labels[c] = point_labels[raw_index[first + c]];
+        }
+
+        if (!write_all(fd, labels.data(), count * sizeof(std::int32_t),
+                       data_offset + (off_t)first * sizeof(std::int32_t)))
+        {
+            std::cerr << "Failed to write " << path << ": " << strerror(errno)
+                      << std::endl;
+            close(fd);
+            return;
+        }
+    }
+    close(fd);
+
+    auto end = std::chrono::steady_clock::now();
+    double total_time =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    double dpu_bytes = (double)N_DPUS * max_objects * sizeof(std::uint64_t);
+
+    // Bytes per microsecond is MB/s
+    std::cerr << "export: " << xfer_time << " us DPU->host (" << dpu_bytes / xfer_time
+              << " MB/s), " << total_time << " us total ("
+              << dpu_bytes / total_time << " MB/s)" << std::endl;
+}
+
+// Reads up to max_points points. Stops early at end of stream, or once the
+// points read are whole and nothing more is pending: a client that sends a
+// short batch and waits for its labels gets them
+static int
+read_points(int fd, std::vector<float> &points, int max_points)
+{
+    char *p = (char *)points.data();
+    size_t point_size = NUM_ATTRIBUTES * sizeof(float);
+    size_t want = (size_t)max_points * point_size;
+    size_t got = 0;
+    struct pollfd pending = {fd, POLLIN, 0};
+
+    while (got < want)
+    {
+        ssize_t n = read(fd, p + got, want - got);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        got += n;
+
+        if (got % point_size == 0 && poll(&pending, 1, 0) == 0)
+        {
+            break;
+        }
+    }
+
+    // A trailing partial point is dropped
+    return got / (NUM_ATTRIBUTES * sizeof(float));
+}
+
+#if USE_WEIGHTS
+// Hash and equality of the points of read_input() by their index in points, so
+// the set of unique points holds 4 bytes per point and no copy of them
+struct PointKey
+{
+    const std::vector<float> *points;
+
+    const unsigned char *
+    bytes(std::uint32_t i) const
+    {
+        return (const unsigned char *)&(*points)[(size_t)i * NUM_ATTRIBUTES];
+    }
+
+    // FNV-1a over the exact bytes of the point
+    size_t
+    operator()(std::uint32_t i) const
+    {
+        const unsigned char *p = bytes(i);
+        std::uint64_t h = 14695981039346656037ULL;
+
+        for (size_t b = 0; b < NUM_ATTRIBUTES * sizeof(float); ++b)
+        {
+            h = (h ^ p[b]) * 1099511628211ULL;
+        }
+
+        return h;
+    }
+
+    bool
+    operator()(std::uint32_t a, std::uint32_t b) const
+    {
+        return memcmp(bytes(a), bytes(b), NUM_ATTRIBUTES * sizeof(float)) == 0;
+    }
+};
+#endif
+
+// Reads raw float32 points, NUM_ATTRIBUTES per row. With USE_WEIGHTS,
+// identical points are merged into one point weighted by its multiplicity and
+// raw_index maps each row to its point. Returns the number of raw points, 0 on
+// error
+long
+read_input(const std::string &path, std::vector<float> &points,
+           std::vector<std::uint32_t> &counts, std::vector<std::uint32_t> &raw_index)
+{
+    std::vector<float> chunk((size_t)LOAD_CHUNK * NUM_ATTRIBUTES);
+#if USE_WEIGHTS
+    PointKey key = {&points};
+    std::unordered_set<std::uint32_t, PointKey, PointKey> unique(LOAD_CHUNK, key, key);
+#endif
+    long n_raw = 0;
+    int n;
+    int fd;
+
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        return 0;
+    }
+
+    while ((n = read_points(fd, chunk, LOAD_CHUNK)) > 0)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            const float *pt = &chunk[(size_t)i * NUM_ATTRIBUTES];
+
+            points.insert(points.end(), pt, pt + NUM_ATTRIBUTES);
+#if USE_WEIGHTS
+            // Appended first, the set looks points up by index; a duplicate is
+            // taken back
+            auto found = unique.insert(counts.size());
+            raw_index.push_back(*found.first);
+            if (!found.second)
+            {
+                counts[*found.first]++;
+                points.resize(points.size() - NUM_ATTRIBUTES);
+                continue;
+            }
+#endif
+            counts.push_back(1);
+        }
+        n_raw += n;
+    }
+    close(fd);
+
+    return n_raw;
+}
+
+// Spreads points evenly over the DPUs of attributes, false if they do not fit
+bool
+spread_points(const std::vector<float> &points, const std::vector<std::uint32_t> &counts,
+              const ArenaView<float> &attributes,
+              const ArenaView<std::uint32_t> &weights,
+              const ArenaView<std::uint64_t> &n_objects)
+{
+    long n_stored = counts.size();
+    long n_dpus = attributes.size();
+
+    if (n_stored == 0 || n_stored > n_dpus * NUM_OBJECTS_PER_DPU)
+    {
+        std::cerr << n_stored << " points to store, the DPUs hold "
+                  << n_dpus * NUM_OBJECTS_PER_DPU << " (NUM_OBJECTS_PER_DPU)"
+                  << std::endl;
+        return false;
+    }
+
+    // The first n_stored % n_dpus DPUs take one more point
+    long first = 0;
+    for (int i = 0; i < n_dpus; ++i)
+    {
+        long count = n_stored / n_dpus + (i < n_stored % n_dpus);
+
+        std::copy(points.begin() + first * NUM_ATTRIBUTES,
+                  points.begin() + (first + count) * NUM_ATTRIBUTES, attributes[i]);
+#if USE_WEIGHTS
+        std::copy(counts.begin() + first, counts.begin() + first + count, weights[i]);
+#endif
+        n_objects[i][0] = count;
+        first += count;
+    }
+
+    return true;
+}
+
+#if !USE_WEIGHTS
+// Reads the rows of a regular file straight into the slots, spread as
+// spread_points() does, so the input is never held twice. Returns the number
+// of points, 0 on error
+static long
+stream_points(const std::string &path, const ArenaView<float> &attributes,
+              const ArenaView<std::uint64_t> &n_objects)
+{
+    size_t point_size = NUM_ATTRIBUTES * sizeof(float);
+    long n_dpus = attributes.size();
+    struct stat st;
+    int fd;
+
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return 0;
+    }
+
+    long n_stored = st.st_size / point_size;
+
+    if (n_stored == 0 || n_stored > n_dpus * NUM_OBJECTS_PER_DPU)
+    {
+        std::cerr << n_stored << " points to store, the DPUs hold "
+                  << n_dpus * NUM_OBJECTS_PER_DPU << " (NUM_OBJECTS_PER_DPU)"
+                  << std::endl;
+        close(fd);
+        return 0;
+    }
+
+    // The first n_stored % n_dpus DPUs take one more point
+    for (int i = 0; i < n_dpus; ++i)
+    {
+        long count = n_stored / n_dpus + (i < n_stored % n_dpus);
+        char *p = (char *)attributes[i];
+        size_t want = count * point_size;
+        size_t got = 0;
+
+        while (got < want)
+        {
+            ssize_t n = read(fd, p + got, want - got);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            got += n;
+        }
+
+        if (got < want)
+        {
+            std::cerr << "Failed to read " << path << ": " << strerror(errno)
+                      << std::endl;
+            close(fd);
+            return 0;
+        }
+        n_objects[i][0] = count;
+    }
+    close(fd);
+
+    return n_stored;
+}
+#endif
+
+long
+load_points(const std::string &path, const ArenaView<float> &attributes,
+            const ArenaView<std::uint32_t> &weights,
+            const ArenaView<std::uint64_t> &n_objects,
+            std::vector<std::uint32_t> &raw_index)
+{
+    long n_raw;
+    long n_stored;
+
+    auto start = std::chrono::steady_clock::now();
+
+#if USE_WEIGHTS
+    std::vector<float> points;
+    std::vector<std::uint32_t> counts;
+
+    n_raw = read_input(path, points, counts, raw_index);
+    if (n_raw == 0 || !spread_points(points, counts, attributes, weights, n_objects))
+    {
+        return 0;
+    }
+    n_stored = counts.size();
+#else
+    n_raw = n_stored = stream_points(path, attributes, n_objects);
+    if (n_raw == 0)
+    {
+        return 0;
+    }
+#endif
+
+    auto end = std::chrono::steady_clock::now();
+    double time =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    std::cerr << "input: " << n_raw << " points, " << n_stored << " stored ("
+              << (double)n_raw / n_stored << "x), " << time << " us" << std::endl;
+
+    return n_raw;
+}
+
+bool
+prepare_points(Topology &topology, const std::string &path, InputSlots &inputs,
+               FitConfig &config)
+{
+    int n_dpus = topology.n_dpus();
+
+    auto start = std::chrono::steady_clock::now();
+    long faults = minor_faults();
+
+    std::vector<int> group_first;
+
+    for (auto &group : topology.groups)
+    {
+        group_first.push_back(group.first_dpu);
+    }
+    inputs.allocate(n_dpus, group_first);
+
+    // Each DPU's slots are placed on the node of its rank
+    topology.for_each_group(
+        [&](DpuGroup &group) { inputs.touch(group.first_dpu, group.n_dpus); });
+
+    auto end = std::chrono::steady_clock::now();
+
+    if (config.verbose)
+    {
+        std::cerr << "inputs: " << inputs.arena->bytes() << " bytes"
+                  << (inputs.arena->hugepages() ? " on hugepages, " : ", ")
+                  << std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+                         .count()
+                  << " us, " << minor_faults() - faults << " page faults" << std::endl;
+    }
+
+    if (path.empty())
+    {
+        generate_initial_points(inputs.attributes);
+        config.n_points = (long)n_dpus * NUM_OBJECTS_PER_DPU;
+    }
+    else if ((config.n_points = load_points(path, inputs.attributes, inputs.weights,
+                                            inputs.n_objects, inputs.raw_index)) == 0)
+    {
+        return false;
+    }
+
+    config.n_objects = 0;
+    for (int i = 0; i < n_dpus; ++i)
+    {
+        config.n_objects += inputs.n_objects[i][0];
+    }
+
+    return true;
+}
+
+void
+upload_points(Topology &topology, const ArenaView<float> &attributes,
+              const ArenaView<std::uint32_t> &weights,
+              const ArenaView<std::uint64_t> &n_objects)
+{
+    // Straight from the group's slots, no staging copy. A node queues all its
+    // ranks before waiting
+    topology.for_each_node([&](std::vector<DpuGroup *> &node) {
+        for (DpuGroup *group : node)
+        {
+            arena_copy(*group->set, DPU_XFER_TO_DPU, "attributes", attributes,
+                       group->first_dpu,
+                       NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES * sizeof(float), 0,
+                       DPU_XFER_ASYNC);
+#if USE_WEIGHTS
+            arena_copy(*group->set, DPU_XFER_TO_DPU, "weights", weights, group->first_dpu,
+                       NUM_OBJECTS_PADDED * sizeof(std::uint32_t), 0, DPU_XFER_ASYNC);
+#endif
+            arena_copy(*group->set, DPU_XFER_TO_DPU, "n_objects", n_objects,
+                       group->first_dpu, sizeof(std::uint64_t), 0, DPU_XFER_ASYNC);
+        }
+        sync_groups(node);
+    });
+}
+
+long
+minor_faults()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+// The host reduction of kmeans(), on whatever holds one slot per DPU
+template <typename Slots>
+static void
+reduce_centers(const Slots &centers, int n_dpus, std::vector<float> &sum)
+{
+    std::fill(sum.begin(), sum.end(), 0);
+    for (int i = 0; i < n_dpus; ++i)
+    {
+        for (size_t j = 0; j < sum.size(); ++j)
+        {
+            sum[j] += centers[i][j];
+        }
+    }
+}
+
+// Host buffers of N_DPUS DPUs, nested vectors against one arena: time to
+// allocate and first touch the input and output slots, page faults taken, and
+// throughput of the center reduction. No DPU is used
+void
+bench_buffers()
+{
+    const int n_dpus = N_DPUS;
+    const int n_reduce = 100;
+    std::vector<float> sum(N_CLUSTERS * NUM_ATTRIBUTES);
+
+    std::cout << "BUFFERS\tN_DPUS\tBYTES\tHUGEPAGES\tALLOC_TIME\tPAGE_FAULTS\tREDUCE_MBPS"
+              << std::endl;
+
+    for (int layout = 0; layout < 2; ++layout)
+    {
+        std::vector<std::vector<float>> nested_attributes;
+        std::vector<std::vector<float>> nested_centers;
+        Arena arena(n_dpus);
+        ArenaView<float> centers = {};
+        size_t bytes;
+
+        auto start = std::chrono::steady_clock::now();
+        long faults = minor_faults();
+
+        if (layout == 0)
+        {
+            nested_attributes.assign(
+                n_dpus, std::vector<float>(NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES));
+            nested_centers.assign(n_dpus,
+                                  std::vector<float>(MAX_N_CLUSTERS * NUM_ATTRIBUTES));
+            bytes = (size_t)n_dpus * (NUM_OBJECTS_PER_DPU + MAX_N_CLUSTERS) *
+                    NUM_ATTRIBUTES * sizeof(float);
+        }
+        else
+        {
+            arena.reserve<float>(NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES);
+            int c = arena.reserve<float>(MAX_N_CLUSTERS * NUM_ATTRIBUTES);
+            arena.map();
+            arena.touch(0, n_dpus);
+            centers = arena.view<float>(c);
+            bytes = arena.bytes();
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        faults = minor_faults() - faults;
+        double alloc_time =
+            std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < n_reduce; ++r)
+        {
+            if (layout == 0)
+            {
+                reduce_centers(nested_centers, n_dpus, sum);
+            }
+            else
+            {
+                reduce_centers(centers, n_dpus, sum);
+            }
+        }
+        end = std::chrono::steady_clock::now();
+        double reduce_time =
+            std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+        std::cout << (layout == 0 ? "nested" : "arena") << "\t" << n_dpus << "\t" << bytes
+                  << "\t" << (layout == 1 && arena.hugepages()) << "\t" << alloc_time
+                  << "\t" << faults << "\t"
+                  << (double)n_reduce * n_dpus * sum.size() * sizeof(float) / reduce_time
+                  << std::endl;
+    }
+}
+
+static bool
+write_labels(int fd, const std::vector<std::int32_t> &labels, int n_points)
+{
+    const char *p = (const char *)labels.data();
+    size_t size = n_points * sizeof(std::int32_t);
+
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+// Labels one stream of points, overlapping the read of batch k + 1 and the
+// write of batch k - 1 with the DPU round trip of batch k
+static void
+predict_stream(DpuSet &system, const std::vector<float> &attr_mean,
+               const std::vector<float> &attr_scale, int fd_in, int fd_out,
+               int batch_size)
+{
+    std::vector<float> points[2] = {
+        std::vector<float>((size_t)batch_size * NUM_ATTRIBUTES),
+        std::vector<float>((size_t)batch_size * NUM_ATTRIBUTES)};
+    std::vector<std::int32_t> labels[2] = {std::vector<std::int32_t>(batch_size),
+                                           std::vector<std::int32_t>(batch_size)};
+
+    Arena arena(N_DPUS);
+    int q = arena.reserve<float>(PREDICT_OBJECTS_PER_DPU * NUM_ATTRIBUTES);
+    int nq = arena.reserve<std::uint64_t>(1);
+    int ql = arena.reserve<std::uint64_t>(PREDICT_OBJECTS_PER_DPU);
+    arena.map();
+    arena.touch(0, N_DPUS);
+    ArenaView<float> queries = arena.view<float>(q);
+    ArenaView<std::uint64_t> n_queries = arena.view<std::uint64_t>(nq);
+    ArenaView<std::uint64_t> query_labels = arena.view<std::uint64_t>(ql);
+
+    std::future<bool> written = std::async(std::launch::deferred, [] { return true; });
+    bool write_ok = true;
+    double max_latency = 0;
+    double sum_latency = 0;
+    long n_points = 0;
+    int n_batches = 0;
+    int cur = 0;
+    int n;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::future<int> next =
+        std::async(std::launch::async, read_points, fd_in, std::ref(points[0]), batch_size);
+
+    while ((n = next.get()) > 0)
+    {
+        next = std::async(std::launch::async, read_points, fd_in,
+                          std::ref(points[cur ^ 1]), batch_size);
+
+        auto start_batch = std::chrono::steady_clock::now();
+
+#if USE_ZSCORE_TRANSFORM
+        // Queries are compared against centers in normalized units
+        normalize_points(points[cur].data(), n, attr_mean, attr_scale);
+#endif
+
+        // Scatter: contiguous slices, rounded up so transfers stay 8 byte multiples
+        int per_dpu = (n + N_DPUS - 1) / N_DPUS;
+        per_dpu += per_dpu & 1;
+
+        for (int i = 0; i < N_DPUS; ++i)
+        {
+            int first = std::min(i * per_dpu, n);
+            int count = std::min(per_dpu, n - first);
+
+            std::copy(points[cur].begin() + (size_t)first * NUM_ATTRIBUTES,
+                      points[cur].begin() + (size_t)(first + count) * NUM_ATTRIBUTES,
+                      queries[i]);
+            n_queries[i][0] = count;
+        }
+
+        arena_copy(system, DPU_XFER_TO_DPU, "n_queries", n_queries, 0,
+                   sizeof(std::uint64_t));
+        arena_copy(system, DPU_XFER_TO_DPU, "queries", queries, 0,
+                   per_dpu * NUM_ATTRIBUTES * sizeof(float));
+
+        system.exec();
+
+        arena_copy(system, DPU_XFER_FROM_DPU, "query_labels", query_labels, 0,
+                   per_dpu * sizeof(std::uint64_t));
+
+        // labels[cur] was last used two batches ago, its write is done
+        for (int i = 0; i < N_DPUS; ++i)
+        {
+            for (std::uint64_t c = 0; c < n_queries[i][0]; ++c)
+            {
+                labels[cur][i * per_dpu + c] = (std::int32_t)query_labels[i][c];
+            }
+        }
+
+        auto end_batch = std::chrono::steady_clock::now();
+        double latency =
+            std::chrono::duration_cast<std::chrono::microseconds>(end_batch - start_batch)
+                .count();
+        max_latency = std::max(max_latency, latency);
+        sum_latency += latency;
+        n_points += n;
+        n_batches++;
+
+        if (!(write_ok = written.get()))
+        {
+            break;
+        }
+        written = std::async(std::launch::async, write_labels, fd_out,
+                             std::cref(labels[cur]), n);
+
+        cur ^= 1;
+    }
+
+    if (write_ok)
+    {
+        write_ok = written.get();
+    }
+    if (!write_ok)
+    {
+        std::cerr << "Failed to write labels: " << strerror(errno) << std::endl;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double total_time =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    if (n_batches > 0)
+    {
+        std::cerr << "predict: " << n_points << " points in " << n_batches << " batches, "
+                  << n_points / (total_time / 1e6) << " queries/s, batch latency avg "
+                  << sum_latency / n_batches << " us max " << max_latency << " us"
+                  << std::endl;
+    }
+}
+
+void
+serve_predictions(DpuSet &system, std::vector<float> &current_cluster_centers,
+                  const std::vector<float> &attr_mean,
+                  const std::vector<float> &attr_scale, const std::string &source,
+                  const std::string &sink, int batch_size)
+{
+    std::vector<std::uint64_t> mode(1, MODE_PREDICT);
+    std::vector<float> current_cluster_norms(N_CLUSTERS_PADDED);
+
+    // n_clusters is left on the DPUs by the fit, norms of unused slots are ignored
+    compute_center_norms(current_cluster_centers, MAX_N_CLUSTERS, current_cluster_norms);
+
+    // Centers stay resident for the whole session
+    system.copy("current_cluster_centers", current_cluster_centers);
+    system.copy("current_cluster_norms", current_cluster_norms);
+    system.copy("mode", mode);
+
+    if (source.compare(0, 5, "unix:") == 0)
+    {
+        struct sockaddr_un addr;
+        int fd;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, source.c_str() + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(fd, 1) < 0)
+        {
+            std::cerr << "Failed to listen on " << source << ": " << strerror(errno)
+                      << std::endl;
+            close(fd);
+            return;
+        }
+
+        // One client at a time, labels are sent back on the same connection
+        while (true)
+        {
+            int client = accept(fd, NULL, NULL);
+            if (client < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            predict_stream(system, attr_mean, attr_scale, client, client, batch_size);
+            close(client);
+        }
+        close(fd);
+    }
+    else
+    {
+        int fd_in = (source == "-") ? STDIN_FILENO : open(source.c_str(), O_RDONLY);
+        int fd_out = (sink == "-") ? STDOUT_FILENO
+                                   : open(sink.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd_in < 0 || fd_out < 0)
+        {
+            std::cerr << "Failed to open " << (fd_in < 0 ? source : sink) << ": "
+                      << strerror(errno) << std::endl;
+        }
+        else
+        {
+            predict_stream(system, attr_mean, attr_scale, fd_in, fd_out, batch_size);
+        }
+
+        if (fd_in > STDIN_FILENO)
+        {
+            close(fd_in);
+        }
+        if (fd_out > STDOUT_FILENO)
+        {
+            close(fd_out);
+        }
+    }
+
+    mode[0] = MODE_FIT;
+    system.copy("mode", mode);
+}
+
+bool
+read_jobs(const std::string &path, std::vector<JobSpec> &jobs)
+{
+    std::ifstream file(path);
+    std::string line;
+
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+        JobSpec job;
+
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        if (!(in >> job.n_ranks >> job.n_clusters) || job.n_ranks < 1 ||
+            job.n_clusters < 1 || job.n_clusters > MAX_N_CLUSTERS)
+        {
+            std::cerr << path << ": bad job \"" << line << "\"" << std::endl;
+            return false;
+        }
+        in >> job.path;
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
+
+// One job on its ranks, with its own points: nothing is shared with the others
+static bool
+run_job(const JobSpec &job, const std::vector<DpuSet *> &ranks, FitConfig config,
+        FitStats &stats)
+{
+    InputSlots inputs;
+    std::vector<float> current_cluster_centers(MAX_N_CLUSTERS * NUM_ATTRIBUTES);
+    std::vector<float> attr_mean(NUM_ATTRIBUTES, 0);
+    std::vector<float> attr_scale(NUM_ATTRIBUTES, 1);
+    Topology topology;
+
+    build_job_topology(ranks, topology);
+    config.n_clusters = job.n_clusters;
+
+    if (!prepare_points(topology, job.path, inputs, config))
+    {
+        return false;
+    }
+
+    upload_points(topology, inputs.attributes, inputs.weights, inputs.n_objects);
+
+#if USE_ZSCORE_TRANSFORM
+    zscore_transform(topology, config.n_points, attr_mean, attr_scale);
+#endif
+
+    pick_initial_centers(inputs.attributes, inputs.n_objects, current_cluster_centers,
+                         job.n_clusters);
+    normalize_points(current_cluster_centers.data(), job.n_clusters, attr_mean,
+                     attr_scale);
+
+    stats = kmeans(topology, config, current_cluster_centers);
+
+    return true;
+}
+
+// Runs the queue on disjoint sets of ranks, one host thread per running job.
+// Whenever a job ends, its ranks go to the first waiting jobs that fit in the
+// free ranks, so a small job may overtake a larger one. serial_pass then runs
+// the same queue again one job at a time, each on the ranks it had, as the
+// baseline
+void
+run_jobs(DpuSet &system, const std::vector<JobSpec> &jobs, const FitConfig &config,
+         bool serial_pass)
+{
+    std::vector<DpuSet *> &ranks = system.ranks();
+    std::vector<int> owner(ranks.size(), -1); // Job holding each rank
+    std::vector<bool> started(jobs.size(), false);
+    std::vector<JobResult> results(jobs.size());
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t n_done = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start] {
+        auto now = std::chrono::steady_clock::now();
+        return (double)std::chrono::duration_cast<std::chrono::microseconds>(now - start)
+            .count();
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        if (jobs[j].n_ranks > (int)ranks.size())
+        {
+            std::cerr << "job " << j << ": " << jobs[j].n_ranks << " ranks, "
+                      << ranks.size() << " allocated" << std::endl;
+            results[j] = {};
+            started[j] = true;
+            n_done++;
+        }
+    }
+
+    while (n_done < jobs.size())
+    {
+        for (size_t j = 0; j < jobs.size(); ++j)
+        {
+            std::vector<int> mine;
+
+            for (size_t r = 0; r < ranks.size(); ++r)
+            {
+                if (owner[r] < 0 && (int)mine.size() < jobs[j].n_ranks)
+                {
+                    mine.push_back(r);
+                }
+            }
+
+            if (started[j] || (int)mine.size() < jobs[j].n_ranks)
+            {
+                continue;
+            }
+
+            started[j] = true;
+            for (int r : mine)
+            {
+                owner[r] = j;
+            }
+
+            threads.emplace_back([&, j, mine] {
+                std::vector<DpuSet *> sets;
+                JobResult result = {};
+
+                result.ranks = mine;
+                for (int r : mine)
+                {
+                    sets.push_back(ranks[r]);
+                    result.n_dpus += ranks[r]->dpus().size();
+                }
+
+                result.start = elapsed();
+                try
+                {
+                    result.ok = run_job(jobs[j], sets, config, result.stats);
+                }
+                catch (const DpuError &e)
+                {
+                    std::cerr << "job " << j << ": " << e.what() << std::endl;
+                }
+                catch (const std::exception &e)
+                {
+                    // Not thrown past the thread: the job fails, the queue goes on
+                    std::cerr << "job " << j << ": " << e.what() << std::endl;
+                }
+                result.end = elapsed();
+
+                std::lock_guard<std::mutex> guard(mutex);
+                for (int r : mine)
+                {
+                    owner[r] = -1;
+                }
+                results[j] = result;
+                n_done++;
+                cond.notify_all();
+            });
+        }
+
+        size_t seen = n_done;
+        cond.wait(lock, [&] { return n_done != seen; });
+    }
+    lock.unlock();
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    double makespan = 0;
+    int n_ok = 0;
+
+    std::cout << "JOB\tRANKS\tDPUS\tK\tLOOPS\tINERTIA\tSTART\tEND" << std::endl;
+
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        if (!results[j].ok)
+        {
+            continue;
+        }
+
+        std::cout << j << "\t" << jobs[j].n_ranks << "\t" << results[j].n_dpus << "\t"
+                  << jobs[j].n_clusters << "\t" << results[j].stats.loops << "\t"
+                  << results[j].stats.inertia << "\t" << results[j].start << "\t"
+                  << results[j].end << std::endl;
+
+        makespan = std::max(makespan, results[j].end);
+        n_ok++;
+    }
+
+    std::cout << "# " << n_ok << " jobs on " << ranks.size() << " ranks, concurrent "
+              << makespan << " us (" << n_ok * 3.6e9 / makespan << " jobs/hour)"
+              << std::endl;
+
+    if (!serial_pass)
+    {
+        return;
+    }
+
+    // The jobs that ran, back to back on the same rank groups
+    auto start_serial = std::chrono::steady_clock::now();
+
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        std::vector<DpuSet *> sets;
+        FitStats stats;
+
+        if (!results[j].ok)
+        {
+            continue;
+        }
+
+        for (int r : results[j].ranks)
+        {
+            sets.push_back(ranks[r]);
+        }
+
+        try
+        {
+            run_job(jobs[j], sets, config, stats);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "serial job " << j << ": " << e.what() << std::endl;
+        }
+    }
+
+    auto end_serial = std::chrono::steady_clock::now();
+    double serial = std::chrono::duration_cast<std::chrono::microseconds>(end_serial -
+                                                                         start_serial)
+                        .count();
+
+    std::cout << "# " << n_ok << " jobs on " << ranks.size() << " ranks, serial "
+              << serial << " us (" << n_ok * 3.6e9 / serial << " jobs/hour)" << std::endl;
+}
+
+static float
+squared_distance(const float *pt1, const float *pt2)
+{
+    float ans = 0;
+
+    for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+    {
+        ans += (pt1[j] - pt2[j]) * (pt1[j] - pt2[j]);
+    }
+
+    return ans;
+}
+
+// MODE_SPLIT: the points of leaf `from` nearer to the second of centers move to
+// leaf `to`. Returns the SSE and the weight of both halves
+static void
+split_points(Topology &topology, std::vector<float> &centers, int from, int to,
+             double inertia[2], double count[2])
+{
+    std::vector<std::uint64_t> mode(1, MODE_SPLIT);
+    std::vector<std::int64_t> split_leaf(1, from);
+    std::vector<std::uint64_t> new_leaf(1, to);
+    std::vector<float> norms(N_CLUSTERS_PADDED);
+    std::mutex mutex;
+
+    compute_center_norms(centers, 2, norms);
+
+    topology.copy("current_cluster_centers", centers);
+    topology.copy("current_cluster_norms", norms);
+    topology.copy("split_leaf", split_leaf);
+    topology.copy("new_leaf", new_leaf);
+    topology.copy("mode", mode);
+    topology.exec();
+
+    inertia[0] = inertia[1] = 0;
+    count[0] = count[1] = 0;
+
+    topology.for_each_group([&](DpuGroup &group) {
+        std::vector<std::vector<double>> split_inertia(group.n_dpus,
+                                                       std::vector<double>(2));
+        std::vector<std::vector<std::uint64_t>> split_count(
+            group.n_dpus, std::vector<std::uint64_t>(2));
+
+        group.set->copy(split_inertia, "split_inertia");
+        group.set->copy(split_count, "split_count");
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < group.n_dpus; ++i)
+        {
+            for (int c = 0; c < 2; ++c)
+            {
+                inertia[c] += split_inertia[i][c];
+                count[c] += split_count[i][c];
+            }
+        }
+    });
+
+    mode[0] = MODE_FIT;
+    topology.copy("mode", mode);
+}
+
+// Bisecting k-means: splits the leaf with the largest SSE with a 2-means on its
+// points only, until there are n_leaves leaves. The DPU kernel never holds more
+// than two centers, so K is not bounded by MAX_N_CLUSTERS
+FitStats
+bisect(Topology &topology, const FitConfig &config, int n_leaves,
+       const ArenaView<float> &attributes,
+       const ArenaView<std::uint64_t> &n_objects,
+       const std::vector<float> &attr_mean, const std::vector<float> &attr_scale,
+       std::vector<TreeNode> &tree)
+{
+    FitConfig split_config = config;
+    std::vector<float> centers(MAX_N_CLUSTERS * NUM_ATTRIBUTES);
+    // Per leaf: SSE (0 once it cannot be split), weight and node in the tree
+    std::vector<double> leaf_inertia(1, std::numeric_limits<double>::infinity());
+    std::vector<double> leaf_count(1, config.n_points);
+    std::vector<int> leaf_node(1, 0);
+    std::mt19937 rng(std::random_device{}());
+    std::normal_distribution<> normal(0, 1);
+    FitStats total = {};
+
+    tree.assign(1, {std::vector<float>(NUM_ATTRIBUTES, 0), -1, -1, 0});
+
+    // The filter reads points one by one, it does not apply to sampling
+    split_config.n_clusters = 2;
+    split_config.batch_fraction = 1;
+    split_config.target_inertia = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    while ((int)leaf_node.size() < n_leaves)
+    {
+        int worst = std::max_element(leaf_inertia.begin(), leaf_inertia.end()) -
+                    leaf_inertia.begin();
+        int new_leaf = leaf_node.size();
+        double inertia[2];
+        double count[2];
+
+        if (leaf_inertia[worst] <= 0)
+        {
+            break;
+        }
+
+        if (new_leaf == 1)
+        {
+            // The root is fitted on all points, which also resets every leaf to 0
+            pick_initial_centers(attributes, n_objects, centers, 2);
+            normalize_points(centers.data(), 2, attr_mean, attr_scale);
+            split_config.split_leaf = -1;
+            split_config.reset_leaves = true;
+        }
+        else
+        {
+            // Both halves start one RMS radius apart along a random direction
+            const std::vector<float> &center = tree[leaf_node[worst]].center;
+            double radius = sqrt(leaf_inertia[worst] / leaf_count[worst]);
+            std::vector<double> dir(NUM_ATTRIBUTES);
+            double norm = 0;
+
+            for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+            {
+                dir[j] = normal(rng);
+                norm += dir[j] * dir[j];
+            }
+            norm = sqrt(norm);
+
+            for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+            {
+                centers[j] = center[j] - 0.5 * radius * dir[j] / norm;
+                centers[NUM_ATTRIBUTES + j] = center[j] + 0.5 * radius * dir[j] / norm;
+            }
+            split_config.split_leaf = worst;
+        }
+        split_config.n_points = leaf_count[worst];
+
+        FitStats stats = kmeans(topology, split_config, centers);
+        total.loops += stats.loops;
+        total.aborts += stats.aborts;
+
+        split_points(topology, centers, worst, new_leaf, inertia, count);
+
+        if (count[0] == 0 || count[1] == 0)
+        {
+            // Degenerate leaf (identical points): put them back and leave it be
+            if (count[0] == 0)
+            {
+                split_points(topology, centers, new_leaf, worst, inertia, count);
+            }
+            leaf_inertia[worst] = 0;
+            continue;
+        }
+
+        int parent = leaf_node[worst];
+        int left = tree.size();
+        int right = left + 1;
+
+        auto half = centers.begin() + NUM_ATTRIBUTES;
+
+        tree.push_back({std::vector<float>(centers.begin(), half), -1, -1, worst});
+        tree.push_back(
+            {std::vector<float>(half, half + NUM_ATTRIBUTES), -1, -1, new_leaf});
+        tree[parent].left = left;
+        tree[parent].right = right;
+        tree[parent].leaf = -1;
+
+        leaf_node[worst] = left;
+        leaf_node.push_back(right);
+        leaf_inertia[worst] = inertia[0];
+        leaf_inertia.push_back(inertia[1]);
+        leaf_count[worst] = count[0];
+        leaf_count.push_back(count[1]);
+
+        if (config.verbose)
+        {
+            std::cerr << "split " << worst << " -> " << new_leaf << ": " << count[0]
+                      << " + " << count[1] << " points" << std::endl;
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    total.time =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    for (int l = 0; l < (int)leaf_node.size(); ++l)
+    {
+        // A leaf never split has no SSE of its own yet, only the root can be one
+        if (!std::isinf(leaf_inertia[l]))
+        {
+            total.inertia += leaf_inertia[l];
+        }
+    }
+
+    return total;
+}
+
+// Descends towards the nearer child: one distance pair per level
+static int
+tree_nearest(const std::vector<TreeNode> &tree, const float *point)
+{
+    int node = 0;
+
+    while (tree[node].leaf < 0)
+    {
+        int left = tree[node].left;
+        int right = tree[node].right;
+
+        node = (squared_distance(point, tree[left].center.data()) <=
+                squared_distance(point, tree[right].center.data()))
+                   ? left
+                   : right;
+    }
+
+    return tree[node].leaf;
+}
+
+// Host-side nearest-leaf lookup on a sample of the points: tree descent
+// against a scan of every leaf
+void
+report_tree_lookup(const std::vector<TreeNode> &tree,
+                   const ArenaView<float> &attributes,
+                   const ArenaView<std::uint64_t> &n_objects,
+                   const std::vector<float> &attr_mean,
+                   const std::vector<float> &attr_scale)
+{
+    int n_points = std::min<int>(n_objects[0][0], 10000);
+    std::vector<float> points(attributes[0], attributes[0] + n_points * NUM_ATTRIBUTES);
+    std::vector<int> tree_labels(n_points);
+    std::vector<int> flat_labels(n_points);
+    int same = 0;
+
+    normalize_points(points.data(), n_points, attr_mean, attr_scale);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < n_points; ++i)
+    {
+        tree_labels[i] = tree_nearest(tree, &points[i * NUM_ATTRIBUTES]);
+    }
+
+    auto mid = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < n_points; ++i)
+    {
+        float best = std::numeric_limits<float>::max();
+
+        for (auto &node : tree)
+        {
+            float dist;
+
+            if (node.leaf < 0)
+            {
+                continue;
+            }
+            dist = squared_distance(&points[i * NUM_ATTRIBUTES], node.center.data());
+            if (dist < best)
+            {
+                best = dist;
+                flat_labels[i] = node.leaf;
+            }
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < n_points; ++i)
+    {
+        same += tree_labels[i] == flat_labels[i];
+    }
+
+    double tree_time =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count();
+    double flat_time =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count();
+
+    std::cerr << "lookup: tree " << tree_time / n_points << " ns/point, flat "
+              << flat_time / n_points << " ns/point, " << 100.0 * same / n_points
+              << "% same leaf" << std::endl;
+}
+
+// Looks up the shape and kernel settings in TUNE_CACHE, the last matching line
+// wins
+static bool
+tune_cache_lookup(int k, long n_points, const KernelSettings &settings,
+                  TuneResult &best)
+{
+    std::ifstream file(TUNE_CACHE);
+    std::string line;
+    bool found = false;
+
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+        TuneResult result;
+        int line_k, line_d;
+        long line_n;
+        std::uint64_t line_policy, line_after, line_kernel;
+
+        in >> line_k >> line_d >> line_n >> result.n_tasklets >> result.points_block >>
+            result.n_dpus >> result.iteration_time >> result.abort_rate >> line_policy >>
+            line_after >> line_kernel;
+
+        if (in && line_k == k && line_d == NUM_ATTRIBUTES && line_n == n_points &&
+            line_policy == settings.cm_policy[0] &&
+            line_after == settings.cm_irrevocable_after[0] &&
+            line_kernel == settings.distance_kernel[0])
+        {
+            best = result;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// Short fit of one candidate build on n_dpus DPUs
+static bool
+tune_run(const std::string &binary, int n_dpus, const std::vector<float> &points,
+         const std::vector<std::uint32_t> &counts, const FitConfig &config,
+         const KernelSettings &settings, TuneResult &result)
+{
+    InputSlots inputs;
+    std::vector<std::vector<std::uint64_t>> dpu_id(n_dpus, std::vector<std::uint64_t>(1));
+    std::vector<float> current_cluster_centers(MAX_N_CLUSTERS * NUM_ATTRIBUTES);
+
+    inputs.allocate(n_dpus);
+    inputs.touch(0, n_dpus);
+    if (!spread_points(points, counts, inputs.attributes, inputs.weights,
+                       inputs.n_objects))
+    {
+        return false;
+    }
+
+    try
+    {
+        auto system = DpuSet::allocate(n_dpus);
+        Topology topology;
+
+        system.load(binary);
+
+        // Timed under the settings of the run being tuned for
+        system.copy("cm_policy", settings.cm_policy);
+        system.copy("cm_irrevocable_after", settings.cm_irrevocable_after);
+        system.copy("distance_kernel", settings.distance_kernel);
+
+        for (int i = 0; i < n_dpus; ++i)
+        {
+            dpu_id[i][0] = i;
+        }
+        system.copy("dpu_id", dpu_id);
+
+        build_topology(system, false, topology);
+        upload_points(topology, inputs.attributes, inputs.weights, inputs.n_objects);
+
+        pick_initial_centers(inputs.attributes, inputs.n_objects, current_cluster_centers,
+                             config.n_clusters);
+        FitStats stats = kmeans(topology, config, current_cluster_centers);
+
+        result.iteration_time = stats.time / stats.loops;
+        result.abort_rate =
+            (double)stats.aborts / ((double)config.n_objects * stats.loops);
+    }
+    catch (const DpuError &e)
+    {
+        std::cerr << binary << " on " << n_dpus << " DPUs: " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Picks NR_TASKLETS, POINTS_BLOCK and the DPU count for the shape (K, D, N):
+// every candidate build of TUNE_DIR is timed on TUNE_LOOPS iterations, on
+// N_DPUS, N_DPUS / 2, ... DPUs as long as the points still fit. Iteration time
+// includes the host reduction, which is what stops more DPUs from paying off.
+// Results are cached in TUNE_CACHE, delete it to calibrate again
+void
+autotune(FitConfig config, const KernelSettings &settings, const std::string &input_path,
+         long n_points)
+{
+    std::vector<float> points;
+    std::vector<std::uint32_t> counts;
+    std::vector<TuneResult> results;
+    TuneResult best = {};
+
+    // Same points for every candidate: those of -f, or n_points generated ones
+    if (!input_path.empty())
+    {
+        std::vector<std::uint32_t> raw_index;
+
+        n_points = read_input(input_path, points, counts, raw_index);
+        if (n_points == 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        InputSlots generated;
+        int n_slots = (n_points + NUM_OBJECTS_PER_DPU - 1) / NUM_OBJECTS_PER_DPU;
+
+        generated.allocate(n_slots);
+        generated.touch(0, n_slots);
+        generate_initial_points(generated.attributes);
+        for (int i = 0; i < n_slots; ++i)
+        {
+            points.insert(points.end(), generated.attributes[i],
+                          generated.attributes[i] + NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES);
+        }
+        points.resize(n_points * NUM_ATTRIBUTES);
+        counts.assign(n_points, 1);
+    }
+
+    if (tune_cache_lookup(config.n_clusters, n_points, settings, best))
+    {
+        std::cout << "# cached: make test NR_TASKLETS=" << best.n_tasklets
+                  << " POINTS_BLOCK=" << best.points_block << " NUM_DPUS=" << best.n_dpus
+                  << " (" << best.iteration_time << " us/iteration)" << std::endl;
+        return;
+    }
+
+    config.n_points = n_points;
+    config.n_objects = counts.size();
+    config.max_loops = TUNE_LOOPS;
+    config.inertia_threshold = 0;
+    config.target_inertia = 0;
+    config.batch_fraction = 1;
+
+    long min_dpus = (config.n_objects + NUM_OBJECTS_PER_DPU - 1) / NUM_OBJECTS_PER_DPU;
+    DIR *dir = opendir(TUNE_DIR);
+    struct dirent *entry;
+
+    if (dir == NULL)
+    {
+        std::cerr << "No candidate builds in " << TUNE_DIR << ", run make tune"
+                  << std::endl;
+        return;
+    }
+
+    std::cout << "NR_TASKLETS\tPOINTS_BLOCK\tN_DPUS\tITERATION_TIME\tABORT_RATE"
+              << std::endl;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        TuneResult result;
+
+        if (sscanf(entry->d_name, "kmeans_t%d_b%d", &result.n_tasklets,
+                   &result.points_block) != 2)
+        {
+            continue;
+        }
+
+        for (int n = N_DPUS; n >= min_dpus && n >= 1; n /= 2)
+        {
+            result.n_dpus = n;
+            if (!tune_run(std::string(TUNE_DIR "/") + entry->d_name, n, points, counts,
+                          config, settings, result))
+            {
+                continue;
+            }
+
+            std::cout << result.n_tasklets << "\t" << result.points_block << "\t" << n
+                      << "\t" << result.iteration_time << "\t" << result.abort_rate
+                      << std::endl;
+            results.push_back(result);
+        }
+    }
+    closedir(dir);
+
+    if (results.empty())
+    {
+        std::cerr << "No candidate could run" << std::endl;
+        return;
+    }
+
+    best = *std::min_element(results.begin(), results.end(),
+                             [](const TuneResult &a, const TuneResult &b) {
+                                 return a.iteration_time < b.iteration_time;
+                             });
+
+    std::ofstream cache(TUNE_CACHE, std::ios::app);
+    cache << config.n_clusters << " " << NUM_ATTRIBUTES << " " << n_points << " "
+          << best.n_tasklets << " " << best.points_block << " " << best.n_dpus << " "
+          << best.iteration_time << " " << best.abort_rate << " "
+          << settings.cm_policy[0] << " " << settings.cm_irrevocable_after[0] << " "
+          << settings.distance_kernel[0] << std::endl;
+
+    std::cout << "# best: make test NR_TASKLETS=" << best.n_tasklets
+              << " POINTS_BLOCK=" << best.points_block << " NUM_DPUS=" << best.n_dpus
+              << " (" << best.iteration_time << " us/iteration)" << std::endl;
 }
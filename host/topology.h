@@ -0,0 +1,459 @@
+#ifndef _TOPOLOGY_H_
+#define _TOPOLOGY_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <dpu>
+#include <dpu_management.h>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../kmeans/common.h"
+#include "arena.h"
+
+using namespace dpu;
+
+// Thread pinned to the CPUs of one NUMA node, running one job at a time
+class NodeWorker
+{
+  public:
+    explicit NodeWorker(int node) : node(node), thread(&NodeWorker::run, this)
+    {
+        cpu_set_t cpus;
+
+        if (node_cpus(node, &cpus))
+        {
+            pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+        }
+    }
+
+    ~NodeWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cond.notify_all();
+        thread.join();
+    }
+
+    void
+    submit(std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = std::move(fn);
+        }
+        cond.notify_all();
+    }
+
+    // Rethrows what the job threw, a DpuError is handled by the caller as if
+    // raised on its own thread
+    void
+    wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return !job; });
+
+        if (error)
+        {
+            std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+    const int node;
+
+  private:
+    void
+    run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true)
+        {
+            cond.wait(lock, [this] { return stop || job; });
+            if (stop)
+            {
+                return;
+            }
+
+            lock.unlock();
+            try
+            {
+                job();
+            }
+            catch (...)
+            {
+                lock.lock();
+                error = std::current_exception();
+                lock.unlock();
+            }
+            lock.lock();
+
+            job = nullptr;
+            cond.notify_all();
+        }
+    }
+
+    // Parses /sys/devices/system/node/nodeN/cpulist ("0-15,32-47")
+    static bool
+    node_cpus(int node, cpu_set_t *cpus)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                           "/cpulist");
+        std::string range;
+        bool found = false;
+
+        CPU_ZERO(cpus);
+        while (std::getline(file, range, ','))
+        {
+            int first, last;
+            char dash;
+            std::istringstream in(range);
+
+            in >> first;
+            last = (in >> dash >> last) ? last : first;
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                CPU_SET(cpu, cpus);
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::function<void()> job;
+    std::exception_ptr error;
+    bool stop = false;
+    std::thread thread;
+};
+
+// Ranks driven together: the whole set in the flat layout, one rank otherwise.
+// Its output slots are first touched by the worker of the group's node, so
+// their pages are placed on that node unless shared with another group.
+struct DpuGroup
+{
+    DpuSet *set;
+    int first_dpu; // Index of its first DPU in the whole set
+    int n_dpus;
+    int worker; // Index in Topology::workers, -1 runs on the calling thread
+
+    // Buffers of Topology::outputs, in reservation order
+    enum
+    {
+        OUT_CENTERS,
+        OUT_CENTERS_LEN,
+        OUT_DELTA,
+        OUT_INERTIA,
+        OUT_ABORTS
+    };
+
+    // OUT, one slot per DPU of the group, indexed from 0
+    ArenaView<float> round_cluster_centers;
+    ArenaView<std::uint32_t> round_cluster_centers_len;
+    ArenaView<std::uint64_t> agregated_delta;
+    ArenaView<double> agregated_inertia;
+    ArenaView<std::uint64_t> agregated_aborts;
+
+    // Partial reduction over the DPUs of the group
+    std::vector<float> sum_centers;
+    std::vector<std::uint64_t> sum_centers_len;
+    std::uint64_t delta;
+    double inertia;
+    std::uint64_t aborts;
+
+    static void
+    reserve_outputs(Arena &outputs)
+    {
+        outputs.reserve<float>(MAX_N_CLUSTERS * NUM_ATTRIBUTES);
+        outputs.reserve<std::uint32_t>(N_CLUSTERS_PADDED);
+        outputs.reserve<std::uint64_t>(1);
+        outputs.reserve<double>(1);
+        outputs.reserve<std::uint64_t>(1);
+    }
+
+    // Takes the group's slots of outputs and touches them from this thread
+    void
+    allocate(Arena &outputs)
+    {
+        outputs.touch(first_dpu, n_dpus);
+        round_cluster_centers = outputs.view<float>(OUT_CENTERS, first_dpu, n_dpus);
+        round_cluster_centers_len =
+            outputs.view<std::uint32_t>(OUT_CENTERS_LEN, first_dpu, n_dpus);
+        agregated_delta = outputs.view<std::uint64_t>(OUT_DELTA, first_dpu, n_dpus);
+        agregated_inertia = outputs.view<double>(OUT_INERTIA, first_dpu, n_dpus);
+        agregated_aborts = outputs.view<std::uint64_t>(OUT_ABORTS, first_dpu, n_dpus);
+        sum_centers.assign(MAX_N_CLUSTERS * NUM_ATTRIBUTES, 0);
+        sum_centers_len.assign(MAX_N_CLUSTERS, 0);
+    }
+};
+
+// The DPUs of one fit. system covers all of them, except for a job that was
+// handed a subset of the ranks (nullptr): those are driven rank by rank.
+struct Topology
+{
+    DpuSet *system;
+    std::vector<DpuGroup> groups;
+    std::vector<std::unique_ptr<NodeWorker>> workers;
+    // Output slots of every group, so small groups share pages
+    std::unique_ptr<Arena> outputs;
+
+    int
+    n_dpus() const
+    {
+        int n = 0;
+
+        for (auto &group : groups)
+        {
+            n += group.n_dpus;
+        }
+
+        return n;
+    }
+
+    // Lays outputs out for the groups, each group touches its own slots
+    void
+    map_outputs()
+    {
+        std::vector<int> group_first;
+
+        for (auto &group : groups)
+        {
+            group_first.push_back(group.first_dpu);
+        }
+
+        outputs.reset(new Arena(n_dpus(), group_first));
+        DpuGroup::reserve_outputs(*outputs);
+        outputs->map();
+    }
+
+    // Broadcasts data to every DPU
+    template <typename T>
+    void
+    copy(const std::string &symbol, std::vector<T> &data)
+    {
+        if (system != nullptr)
+        {
+            system->copy(symbol, data);
+            return;
+        }
+
+        for (auto &group : groups)
+        {
+            group.set->copy(symbol, data);
+        }
+    }
+
+    // Launches every DPU and waits, ranks without a common set concurrently
+    void
+    exec()
+    {
+        if (system != nullptr)
+        {
+            system->exec();
+            return;
+        }
+
+        std::vector<std::future<void>> launches;
+
+        for (auto &group : groups)
+        {
+            DpuSet *set = group.set;
+            launches.push_back(std::async(std::launch::async, [set] { set->exec(); }));
+        }
+
+        for (auto &launch : launches)
+        {
+            launch.get();
+        }
+    }
+
+    // Runs fn on every group, each on the worker of its node, and waits
+    void
+    for_each_group(const std::function<void(DpuGroup &)> &fn)
+    {
+        for_each_node([&fn](std::vector<DpuGroup *> &node) {
+            for (DpuGroup *group : node)
+            {
+                fn(*group);
+            }
+        });
+    }
+
+    // Runs fn once per node on the groups of that node, on its worker, and
+    // waits. Groups without a worker form one node on the calling thread. A node
+    // can queue transfers on all its ranks before waiting for any
+    void
+    for_each_node(const std::function<void(std::vector<DpuGroup *> &)> &fn)
+    {
+        std::vector<std::vector<DpuGroup *>> nodes(workers.size() + 1);
+
+        for (auto &group : groups)
+        {
+            nodes[group.worker + 1].push_back(&group);
+        }
+
+        for (auto &worker : workers)
+        {
+            std::vector<DpuGroup *> &node = nodes[&worker - &workers[0] + 1];
+
+            worker->submit([&node, &fn] { fn(node); });
+        }
+
+        // Every worker is waited for before rethrowing, fn must outlive them
+        std::exception_ptr error;
+
+        try
+        {
+            if (!nodes[0].empty())
+            {
+                fn(nodes[0]);
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        for (auto &worker : workers)
+        {
+            try
+            {
+                worker->wait();
+            }
+            catch (...)
+            {
+                error = error ? error : std::current_exception();
+            }
+        }
+
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// Waits for the transfers queued with DPU_XFER_ASYNC on the ranks of a node
+inline void
+sync_groups(const std::vector<DpuGroup *> &node)
+{
+    for (DpuGroup *group : node)
+    {
+        DpuError::throwOnErr(dpu_sync(group->set->cDpuSet()));
+    }
+}
+
+// NUMA node of a rank, exposed by the driver in sysfs under the rank's device
+// ID. The allocation may start at any rank, its position in the set says nothing
+inline int
+rank_numa_node(DpuSet &rank)
+{
+    struct dpu_set_t dpu;
+    uint32_t i;
+    int id = 0;
+
+    DPU_FOREACH(rank.cDpuSet(), dpu, i)
+    {
+        id = dpu_get_rank_id(dpu_get_rank(dpu_from_set(dpu)));
+        break;
+    }
+
+    std::ifstream file("/sys/class/dpu_rank/dpu_rank" + std::to_string(id) +
+                       "/numa_node");
+    int node = 0;
+
+    if (!(file >> node) || node < 0)
+    {
+        node = 0;
+    }
+
+    return node;
+}
+
+// Flat: one group, driven by the calling thread. NUMA aware: one group per
+// rank and one pinned worker per node that hosts ranks.
+inline void
+build_topology(DpuSet &system, bool numa_aware, Topology &topology)
+{
+    topology.system = &system;
+    topology.groups.clear();
+    topology.workers.clear();
+
+    if (!numa_aware)
+    {
+        topology.groups.push_back({&system, 0, (int)system.dpus().size(), -1});
+        topology.map_outputs();
+        topology.groups.back().allocate(*topology.outputs);
+        return;
+    }
+
+    std::vector<int> worker_of_node;
+    int first_dpu = 0;
+
+    for (DpuSet *rank : system.ranks())
+    {
+        int node = rank_numa_node(*rank);
+
+        if (node >= (int)worker_of_node.size())
+        {
+            worker_of_node.resize(node + 1, -1);
+        }
+        if (worker_of_node[node] < 0)
+        {
+            worker_of_node[node] = topology.workers.size();
+            topology.workers.emplace_back(new NodeWorker(node));
+        }
+
+        int n_dpus = rank->dpus().size();
+        topology.groups.push_back({rank, first_dpu, n_dpus, worker_of_node[node]});
+        first_dpu += n_dpus;
+    }
+
+    topology.map_outputs();
+    topology.for_each_group([&topology](DpuGroup &group) {
+        group.allocate(*topology.outputs);
+    });
+}
+
+// A job's share of the allocation: one group per rank, DPUs numbered from 0
+inline void
+build_job_topology(const std::vector<DpuSet *> &ranks, Topology &topology)
+{
+    int first_dpu = 0;
+
+    topology.system = (ranks.size() == 1) ? ranks[0] : nullptr;
+    topology.groups.clear();
+    topology.workers.clear();
+
+    for (DpuSet *rank : ranks)
+    {
+        int n_dpus = rank->dpus().size();
+
+        topology.groups.push_back({rank, first_dpu, n_dpus, -1});
+        first_dpu += n_dpus;
+    }
+
+    topology.map_outputs();
+    for (auto &group : topology.groups)
+    {
+        group.allocate(*topology.outputs);
+    }
+}
+
+#endif /* _TOPOLOGY_H_ */
@@ -0,0 +1,35 @@
+#ifndef _COMMON_H_
+#define _COMMON_H_
+
+/* Work done by a launch, selected by the host through the `mode` symbol */
+enum
+{
+    MODE_FIT = 0,     /* One Lloyd iteration over attributes */
+    MODE_PREDICT = 1, /* Label the n_queries points in queries */
+    MODE_STATS = 2,   /* Per-dimension sum and sum of squares of attributes */
+    MODE_ZSCORE = 3,  /* attributes = (attributes - attr_mean) * attr_scale */
+    MODE_BENCH = 4,   /* Time the assignment of every point, nothing else */
+    MODE_SPLIT = 5,   /* Split split_leaf in two along the first two centers */
+};
+
+/* Bits of `init`, what a fit resets before its first launch */
+enum
+{
+    INIT_MEMBERSHIP = 1, /* Every point unassigned */
+    INIT_LEAVES = 2,     /* Bisecting: every point back in leaf 0 */
+};
+
+/* Assignment kernels, selected by the host through `distance_kernel` */
+enum
+{
+    DISTANCE_BASELINE = 0, /* Full squared distance to every center */
+    DISTANCE_PARTIAL = 1,  /* Abandon a center once past the best distance */
+    DISTANCE_DOT = 2,      /* argmin of |c|^2 - 2 x.c with host-computed |c|^2 */
+    N_DISTANCE_KERNELS
+};
+
+/* uint32_t per-center buffers are padded so transfers stay 8 byte multiples */
+#define N_CLUSTERS_PADDED ((MAX_N_CLUSTERS + 1) & ~1)
+#define NUM_OBJECTS_PADDED ((NUM_OBJECTS_PER_DPU + 1) & ~1)
+
+#endif /* _COMMON_H_ */
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,11 +8,13 @@
 #include <defs.h>
 #include <limits.h>
 #include <mram.h>
+#include <mutex.h>
 #include <norec.h>
 #include <perfcounter.h>
 
 #include <thread_def.h>
 
+#include "common.h"
 #include "kmeans_macros.h"
 
 BARRIER_INIT(kmeans_barr, NR_TASKLETS);
@@ -26,17 +29,88 @@ BARRIER_INIT(kmeans_barr, NR_TASKLETS);
 
 // Input variables
 __mram float attributes[NUM_OBJECTS_PER_DPU * NUM_ATTRIBUTES];
+#if USE_WEIGHTS
+// Raw points each stored point stands for
+__mram uint32_t weights[NUM_OBJECTS_PADDED];
+#endif
+// Points actually stored in attributes, the rest of the buffer is ignored
+__host uint64_t n_objects = NUM_OBJECTS_PER_DPU;
 __host uint64_t init;
-__host __dma_aligned float current_cluster_centers[N_CLUSTERS * NUM_ATTRIBUTES];
+__host uint64_t mode;
+__host uint64_t n_clusters;
+__host uint64_t dpu_id;
+// Mini-batch: points sampled per launch (0 for full batch) and RNG seed
+__host uint64_t batch_size;
+__host uint64_t batch_seed;
+#ifdef CENTERS_IN_MRAM
+__mram float current_cluster_centers[MAX_N_CLUSTERS * NUM_ATTRIBUTES];
+#else
+__host __dma_aligned float current_cluster_centers[MAX_N_CLUSTERS * NUM_ATTRIBUTES];
+#endif
+// Squared norms of the centers, shipped by the host with the centers
+__host __dma_aligned float current_cluster_norms[N_CLUSTERS_PADDED];
+__host uint64_t distance_kernel = DISTANCE_KERNEL;
+// Bisecting: a fit only sees the points of split_leaf (-1 for all of them),
+// MODE_SPLIT moves those nearest to the second center to new_leaf
+__host int64_t split_leaf = -1;
+__host uint64_t new_leaf;
 
 // Output variables
-__host float local_cluster_centers[N_CLUSTERS * NUM_ATTRIBUTES];
-__host uint32_t local_centers_len[N_CLUSTERS];
+#ifdef ACC_IN_MRAM
+__mram float local_cluster_centers[MAX_N_CLUSTERS * NUM_ATTRIBUTES];
+__mram uint32_t local_centers_len[N_CLUSTERS_PADDED];
+#else
+__host float local_cluster_centers[MAX_N_CLUSTERS * NUM_ATTRIBUTES];
+__host uint32_t local_centers_len[N_CLUSTERS_PADDED];
+#endif
 __host uint64_t agregated_delta;
+__host double agregated_inertia;
+__host uint64_t agregated_aborts;
+__host uint64_t bench_cycles;
+__host double split_inertia[2];
+__host uint64_t split_count[2];
 
 // Variables for local use
 float delta_per_thread[NR_TASKLETS];
+double inertia_per_thread[NR_TASKLETS];
+uint32_t aborts_per_thread[NR_TASKLETS];
 __mram uint64_t membership[NUM_OBJECTS_PER_DPU];
+// Bisecting: leaf of every point, only reset when init has INIT_LEAVES
+__mram uint32_t leaf[NUM_OBJECTS_PADDED];
+double split_inertia_per_thread[NR_TASKLETS][2];
+uint64_t split_count_per_thread[NR_TASKLETS][2];
+
+// Points are assigned POINTS_BLOCK at a time, so that with CENTERS_IN_MRAM
+// each tile of CENTERS_TILE centers is fetched once per block
+__dma_aligned float points_block[NR_TASKLETS][POINTS_BLOCK * NUM_ATTRIBUTES];
+int block_ids[NR_TASKLETS][POINTS_BLOCK];
+int block_index[NR_TASKLETS][POINTS_BLOCK];
+float block_dist[NR_TASKLETS][POINTS_BLOCK];
+#if USE_WEIGHTS
+uint32_t block_weight[NR_TASKLETS][POINTS_BLOCK];
+__dma_aligned uint32_t weights_buf[NR_TASKLETS][POINTS_BLOCK + 2];
+#endif
+__dma_aligned uint32_t leaf_buf[NR_TASKLETS][POINTS_BLOCK + 2];
+// With an odd POINTS_BLOCK, two tasklets may share an 8 byte word of leaf
+MUTEX_INIT(leaf_mutex);
+uint64_t sample_seed[NR_TASKLETS];
+int sample_left[NR_TASKLETS];
+#ifdef CENTERS_IN_MRAM
+__dma_aligned float centers_tile[NR_TASKLETS][CENTERS_TILE * NUM_ATTRIBUTES];
+#endif
+
+// Z-score pre-pass
+#define STATS_DIMS 16
+__host double attr_sum[NUM_ATTRIBUTES];
+__host double attr_sumsq[NUM_ATTRIBUTES];
+__host __dma_aligned float attr_mean[NUM_ATTRIBUTES];
+__host __dma_aligned float attr_scale[NUM_ATTRIBUTES];
+double stats_per_thread[NR_TASKLETS][2][STATS_DIMS];
+
+// Prediction batches, independent from the training data
+__mram float queries[PREDICT_OBJECTS_PER_DPU * NUM_ATTRIBUTES];
+__host uint64_t n_queries;
+__mram uint64_t query_labels[PREDICT_OBJECTS_PER_DPU];
 
 #ifdef TX_IN_MRAM
 Thread __mram_noinit t_mram[NR_TASKLETS];
@@ -45,7 +119,24 @@ Thread __mram_noinit t_mram[NR_TASKLETS];
 float
 euclidian_distance(float *pt1, float *pt2);
 int
-find_nearest_center(float *pt, float *centers);
+find_nearest_center(float *pt, float *centers, float *norms, int n_centers,
+                    float *min_dist);
+void
+find_nearest_centers(int tid, int n_points);
+int
+load_block(int tid, int blk);
+int
+find_nearest_center_baseline(float *pt, float *centers, int n_centers, float *min_dist);
+void
+predict(int tid);
+void
+compute_stats(int tid);
+void
+zscore_transform(int tid);
+void
+bench_assignment(int tid);
+void
+split(int tid);
 
 int
 main()
@@ -58,12 +149,42 @@ main()
     int index;
     int tmp_center_len;
     float tmp_center_attr;
-
-    __dma_aligned float tmp_point[NUM_ATTRIBUTES];
+    uint32_t weight;
+    float *tmp_point;
 
     tid = me();
     s = (uint64_t)me();
 
+    if (mode == MODE_PREDICT)
+    {
+        predict(tid);
+        return 0;
+    }
+
+    if (mode == MODE_STATS)
+    {
+        compute_stats(tid);
+        return 0;
+    }
+
+    if (mode == MODE_ZSCORE)
+    {
+        zscore_transform(tid);
+        return 0;
+    }
+
+    if (mode == MODE_BENCH)
+    {
+        bench_assignment(tid);
+        return 0;
+    }
+
+    if (mode == MODE_SPLIT)
+    {
+        split(tid);
+        return 0;
+    }
+
 #ifdef TX_IN_MRAM
     TxInit(&t_mram[tid], tid);
 #else
@@ -72,23 +193,32 @@ main()
 
     // -------------------------------------------------------------------
 
-    if (MIN_N_CLUSTERS != MAX_N_CLUSTERS || USE_ZSCORE_TRANSFORM != 0)
+    if (n_clusters > MAX_N_CLUSTERS)
     {
         assert(0);
     }
 
-    if (tid == 0)
+    /* Tasklets reset interleaved pairs of points, a pair shares a word of leaf */
+    if (init != 0)
     {
-        if (init == 1)
+        for (int i = 2 * tid; i < NUM_OBJECTS_PER_DPU; i += 2 * NR_TASKLETS)
         {
-            for (int i = 0; i < NUM_OBJECTS_PER_DPU; ++i)
+            membership[i] = -1;
+            if (i + 1 < NUM_OBJECTS_PER_DPU)
+            {
+                membership[i + 1] = -1;
+            }
+            if (init & INIT_LEAVES)
             {
-                membership[i] = -1;
+                leaf[i] = 0;
+                leaf[i + 1] = 0;
             }
-            init = 0;
-        }   
+        }
+    }
 
-        for (int i = 0; i < N_CLUSTERS; ++i)
+    if (tid == 0)
+    {
+        for (int i = 0; i < n_clusters; ++i)
         {
             local_centers_len[i] = 0;
             for (int j = 0; j < NUM_ATTRIBUTES; ++j)
@@ -99,82 +229,112 @@ main()
     }
     barrier_wait(&kmeans_barr);
 
+    if (tid == 0)
+    {
+        init = 0;
+    }
+
     // ==========================================================================
 
     delta_per_thread[tid] = 0;
+    inertia_per_thread[tid] = 0;
 
-    for (int i = tid; i < NUM_OBJECTS_PER_DPU; i += NR_TASKLETS)
-    {
-        mram_read(&attributes[i * NUM_ATTRIBUTES], tmp_point, sizeof(tmp_point));
+    /* Per-DPU, per-tasklet stream, a different sample every launch */
+    sample_seed[tid] = batch_seed ^ (dpu_id << 16) ^ ((uint64_t)tid << 8);
+    sample_left[tid] = batch_size / NR_TASKLETS + (tid < batch_size % NR_TASKLETS);
 
-        index = find_nearest_center(tmp_point, current_cluster_centers);
-        // printf(">> %d\n", index);
+    for (int blk = 0, n_block; (n_block = load_block(tid, blk)) >= 0; ++blk)
+    {
+        find_nearest_centers(tid, n_block);
 
-        if (membership[i] != index)
+        for (int p = 0; p < n_block; ++p)
         {
-            delta_per_thread[tid] += 1.0;
-        }
+            int i = block_ids[tid][p];
+
+            tmp_point = &points_block[tid][p * NUM_ATTRIBUTES];
+            index = block_index[tid][p];
+            // printf(">> %d\n", index);
+
+#if USE_WEIGHTS
+            weight = block_weight[tid][p];
+#else
+            weight = 1;
+#endif
+
+            inertia_per_thread[tid] += (double)weight * block_dist[tid][p];
+
+            if (membership[i] != index)
+            {
+                delta_per_thread[tid] += weight;
+            }
 
-        membership[i] = index;
+            membership[i] = index;
 
 #ifdef TX_IN_MRAM
-        START(&(t_mram[tid]));
+            START(&(t_mram[tid]));
 #else
-        START(&tx);
+            START(&tx);
 #endif
 
 #ifdef TX_IN_MRAM
-        tmp_center_len = LOAD(&(t_mram[tid]), &local_centers_len[index]);
+            tmp_center_len = LOAD(&(t_mram[tid]), &local_centers_len[index]);
 #else
-        tmp_center_len = LOAD(&tx, &local_centers_len[index]);
+            tmp_center_len = LOAD(&tx, &local_centers_len[index]);
 #endif
 
-        tmp_center_len++;
+            tmp_center_len += weight;
 
 #ifdef TX_IN_MRAM
-        STORE(&(t_mram[tid]), &local_centers_len[index], tmp_center_len);
+            STORE(&(t_mram[tid]), &local_centers_len[index], tmp_center_len);
 #else
-        STORE(&tx, &local_centers_len[index], tmp_center_len);
+            STORE(&tx, &local_centers_len[index], tmp_center_len);
 #endif
-        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
-        {
+            for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+            {
 #ifdef TX_IN_MRAM
-            intptr_t tmp = LOAD_LOOP(
-                &(t_mram[tid]), &local_cluster_centers[(index * NUM_ATTRIBUTES) + j]);
+                intptr_t tmp = LOAD_LOOP(
+                    &(t_mram[tid]), &local_cluster_centers[(index * NUM_ATTRIBUTES) + j]);
 #else
-            intptr_t tmp =
-                LOAD_LOOP(&tx, &local_cluster_centers[(index * NUM_ATTRIBUTES) + j]);
+                intptr_t tmp =
+                    LOAD_LOOP(&tx, &local_cluster_centers[(index * NUM_ATTRIBUTES) + j]);
 #endif
-            tmp_center_attr = intp2double(tmp) + tmp_point[j];
+                tmp_center_attr = intp2double(tmp) + weight * tmp_point[j];
 
 #ifdef TX_IN_MRAM
-            STORE_LOOP(&(t_mram[tid]),
-                       &local_cluster_centers[(index * NUM_ATTRIBUTES) + j],
-                       double2intp(tmp_center_attr));
+                STORE_LOOP(&(t_mram[tid]),
+                           &local_cluster_centers[(index * NUM_ATTRIBUTES) + j],
+                           double2intp(tmp_center_attr));
 #else
-            STORE_LOOP(&tx, &local_cluster_centers[(index * NUM_ATTRIBUTES) + j],
-                       double2intp(tmp_center_attr));
+                STORE_LOOP(&tx, &local_cluster_centers[(index * NUM_ATTRIBUTES) + j],
+                           double2intp(tmp_center_attr));
 #endif
-        }
+            }
 
 #ifdef TX_IN_MRAM
-        if (tx_mram[tid].status == 4)
-        {
-            continue;
-        }
+            if (t_mram[tid].status == 4)
+            {
+                continue;
+            }
 #else
-        if (tx.status == 4)
-        {
-            continue;
-        }
+            if (tx.status == 4)
+            {
+                continue;
+            }
 #endif
 
 #ifdef TX_IN_MRAM
-        COMMIT(&(t_mram[tid]));
+            COMMIT(&(t_mram[tid]));
 #else
-        COMMIT(&tx);
+            COMMIT(&tx);
 #endif
+        }
     }
+
+#ifdef TX_IN_MRAM
+    aborts_per_thread[tid] = t_mram[tid].Aborts;
+#else
+    aborts_per_thread[tid] = tx.Aborts;
+#endif
     barrier_wait(&kmeans_barr);
 
     // ==========================================================================
@@ -182,9 +342,13 @@ main()
     if (tid == 0)
     {
         agregated_delta = 0;
+        agregated_inertia = 0;
+        agregated_aborts = 0;
         for (int i = 0; i < NR_TASKLETS; ++i)
         {
             agregated_delta += delta_per_thread[i];
+            agregated_inertia += inertia_per_thread[i];
+            agregated_aborts += aborts_per_thread[i];
         }
     }
     barrier_wait(&kmeans_barr);
@@ -205,14 +369,122 @@ euclidian_distance(float *pt1, float *pt2)
     return ans;
 }
 
+/* Stops as soon as the partial sum reaches bound, the result is then >= bound */
+static inline float
+euclidian_distance_bounded(float *pt1, float *pt2, float bound)
+{
+    float ans = 0.0F;
+    int i = 0;
+
+    for (; i + 4 <= NUM_ATTRIBUTES; i += 4)
+    {
+#pragma unroll
+        for (int k = i; k < i + 4; ++k)
+        {
+            ans += (pt1[k] - pt2[k]) * (pt1[k] - pt2[k]);
+        }
+
+        if (ans >= bound)
+        {
+            return ans;
+        }
+    }
+
+#pragma unroll
+    for (; i < NUM_ATTRIBUTES; ++i)
+    {
+        ans += (pt1[i] - pt2[i]) * (pt1[i] - pt2[i]);
+    }
+
+    return ans;
+}
+
+static inline float
+dot_product(float *pt1, float *pt2)
+{
+    float ans = 0.0F;
+
+#pragma unroll
+    for (int i = 0; i < NUM_ATTRIBUTES; ++i)
+    {
+        ans += pt1[i] * pt2[i];
+    }
+
+    return ans;
+}
+
+/* *min_dist is the distance to beat on entry, that of the returned center on
+ * exit. -1 and *min_dist unchanged when no center is closer */
 int
-find_nearest_center(float *pt, float *centers)
+find_nearest_center(float *pt, float *centers, float *norms, int n_centers,
+                    float *min_dist)
+{
+    if (distance_kernel == DISTANCE_PARTIAL)
+    {
+        int index = -1;
+        float best = *min_dist;
+
+        for (int i = 0; i < n_centers; ++i)
+        {
+            float dist =
+                euclidian_distance_bounded(pt, &centers[i * NUM_ATTRIBUTES], best);
+
+            if (dist < best)
+            {
+                best = dist;
+                index = i;
+                if (best == 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        *min_dist = best;
+
+        return index;
+    }
+
+    if (distance_kernel == DISTANCE_DOT)
+    {
+        /* |x - c|^2 = |x|^2 + |c|^2 - 2 x.c, |x|^2 does not change the argmin */
+        int index = -1;
+        float best = 3.402823466e+38F;
+
+        for (int i = 0; i < n_centers; ++i)
+        {
+            float score = norms[i] - 2 * dot_product(pt, &centers[i * NUM_ATTRIBUTES]);
+
+            if (score < best)
+            {
+                best = score;
+                index = i;
+            }
+        }
+
+        best += dot_product(pt, pt);
+        /* Rounding may leave a tiny negative value */
+        best = (best > 0) ? best : 0;
+        if (best >= *min_dist)
+        {
+            return -1;
+        }
+        *min_dist = best;
+
+        return index;
+    }
+
+    return find_nearest_center_baseline(pt, centers, n_centers, min_dist);
+}
+
+int
+find_nearest_center_baseline(float *pt, float *centers, int n_centers, float *min_dist)
 {
     int index = -1;
-    float max_dist = 3.402823466e+38F; // TODO: might be a bug
+    float max_dist = *min_dist;
 
     /* Find the cluster center id with min distance to pt */
-    for (int i = 0; i < N_CLUSTERS; ++i)
+    for (int i = 0; i < n_centers; ++i)
     {
         float dist;
         /* no need square root */
@@ -229,5 +501,354 @@ find_nearest_center(float *pt, float *centers)
         }
     }
 
+    /* Squared distance to the winner, summed by the caller into the SSE */
+    *min_dist = max_dist;
+
     return index;
 }
+
+#if USE_WEIGHTS
+// Copies the weights of points [i, i + n) to block_weight[tid] from slot p on,
+// the MRAM read is widened to 8 byte bounds
+static void
+load_weights(int tid, int i, int n, int p)
+{
+    int first = i & ~1;
+    int last = (i + n + 1) & ~1;
+
+    mram_read(&weights[first], weights_buf[tid], (last - first) * sizeof(uint32_t));
+
+    for (int k = 0; k < n; ++k)
+    {
+        block_weight[tid][p + k] = weights_buf[tid][i - first + k];
+    }
+}
+#endif
+
+// Fills points_block with the blk-th block of the tasklet: consecutive points
+// in full batch, batch_size / NR_TASKLETS random ones in mini-batch. Returns
+// the number of points loaded, possibly 0 when filtering, -1 past the last block
+int
+load_block(int tid, int blk)
+{
+    int n_block;
+
+    if (n_objects == 0)
+    {
+        return -1;
+    }
+
+    if (batch_size == 0)
+    {
+        int b = ((blk * NR_TASKLETS) + tid) * POINTS_BLOCK;
+
+        if (b >= n_objects)
+        {
+            return -1;
+        }
+        n_block = (n_objects - b < POINTS_BLOCK) ? n_objects - b : POINTS_BLOCK;
+
+        /* Bisecting: only the points of the leaf being split are read */
+        if (split_leaf >= 0)
+        {
+            int first = b & ~1;
+            int last = (b + n_block + 1) & ~1;
+            int n = 0;
+
+            mram_read(&leaf[first], leaf_buf[tid], (last - first) * sizeof(uint32_t));
+
+            for (int p = 0; p < n_block; ++p)
+            {
+                if (leaf_buf[tid][b - first + p] != split_leaf)
+                {
+                    continue;
+                }
+
+                mram_read_large(&attributes[(b + p) * NUM_ATTRIBUTES],
+                                &points_block[tid][n * NUM_ATTRIBUTES],
+                                NUM_ATTRIBUTES * sizeof(float));
+#if USE_WEIGHTS
+                load_weights(tid, b + p, 1, n);
+#endif
+                block_ids[tid][n++] = b + p;
+            }
+
+            return n;
+        }
+
+        mram_read_large(&attributes[b * NUM_ATTRIBUTES], points_block[tid],
+                        n_block * NUM_ATTRIBUTES * sizeof(float));
+#if USE_WEIGHTS
+        load_weights(tid, b, n_block, 0);
+#endif
+
+        for (int p = 0; p < n_block; ++p)
+        {
+            block_ids[tid][p] = b + p;
+        }
+
+        return n_block;
+    }
+
+    if (sample_left[tid] == 0)
+    {
+        return -1;
+    }
+
+    n_block = (sample_left[tid] < POINTS_BLOCK) ? sample_left[tid] : POINTS_BLOCK;
+    sample_left[tid] -= n_block;
+
+    for (int p = 0; p < n_block; ++p)
+    {
+        int i = RAND_R_FNC(sample_seed[tid]) % n_objects;
+
+        mram_read_large(&attributes[i * NUM_ATTRIBUTES],
+                        &points_block[tid][p * NUM_ATTRIBUTES],
+                        NUM_ATTRIBUTES * sizeof(float));
+#if USE_WEIGHTS
+        load_weights(tid, i, 1, p);
+#endif
+        block_ids[tid][p] = i;
+    }
+
+    return n_block;
+}
+
+void
+find_nearest_centers(int tid, int n_points)
+{
+    float *points = points_block[tid];
+
+    if (n_points == 0)
+    {
+        return;
+    }
+
+#ifdef CENTERS_IN_MRAM
+    float *tile = centers_tile[tid];
+
+    for (int p = 0; p < n_points; ++p)
+    {
+        block_index[tid][p] = -1;
+        block_dist[tid][p] = 3.402823466e+38F;
+    }
+
+    /* Centers are streamed from MRAM, one WRAM tile at a time */
+    for (int c = 0; c < n_clusters; c += CENTERS_TILE)
+    {
+        int n_tile = (n_clusters - c < CENTERS_TILE) ? n_clusters - c : CENTERS_TILE;
+
+        mram_read_large(&current_cluster_centers[c * NUM_ATTRIBUTES], tile,
+                        n_tile * NUM_ATTRIBUTES * sizeof(float));
+
+        /* The best distance of the previous tiles bounds the partial kernel */
+        for (int p = 0; p < n_points; ++p)
+        {
+            int index = find_nearest_center(&points[p * NUM_ATTRIBUTES], tile,
+                                            &current_cluster_norms[c], n_tile,
+                                            &block_dist[tid][p]);
+
+            if (index >= 0)
+            {
+                block_index[tid][p] = c + index;
+            }
+        }
+    }
+#else
+    for (int p = 0; p < n_points; ++p)
+    {
+        block_dist[tid][p] = 3.402823466e+38F;
+        block_index[tid][p] =
+            find_nearest_center(&points[p * NUM_ATTRIBUTES], current_cluster_centers,
+                                current_cluster_norms, n_clusters, &block_dist[tid][p]);
+    }
+#endif
+}
+
+void
+predict(int tid)
+{
+    /* Assignment only: no accumulation, hence no transactions */
+    for (int b = tid * POINTS_BLOCK; b < n_queries; b += NR_TASKLETS * POINTS_BLOCK)
+    {
+        int n_block = (n_queries - b < POINTS_BLOCK) ? n_queries - b : POINTS_BLOCK;
+
+        mram_read_large(&queries[b * NUM_ATTRIBUTES], points_block[tid],
+                        n_block * NUM_ATTRIBUTES * sizeof(float));
+
+        find_nearest_centers(tid, n_block);
+
+        for (int p = 0; p < n_block; ++p)
+        {
+            query_labels[b + p] = block_index[tid][p];
+        }
+    }
+}
+
+void
+compute_stats(int tid)
+{
+    __dma_aligned float tmp_slice[STATS_DIMS];
+
+    /* Dimensions are done STATS_DIMS at a time to bound the per-tasklet partials */
+    for (int d = 0; d < NUM_ATTRIBUTES; d += STATS_DIMS)
+    {
+        int n_dims = (NUM_ATTRIBUTES - d < STATS_DIMS) ? NUM_ATTRIBUTES - d : STATS_DIMS;
+
+        for (int j = 0; j < n_dims; ++j)
+        {
+            stats_per_thread[tid][0][j] = 0;
+            stats_per_thread[tid][1][j] = 0;
+        }
+
+        for (int i = tid; i < n_objects; i += NR_TASKLETS)
+        {
+            float w = 1;
+
+            mram_read(&attributes[(i * NUM_ATTRIBUTES) + d], tmp_slice,
+                      n_dims * sizeof(float));
+#if USE_WEIGHTS
+            load_weights(tid, i, 1, 0);
+            w = block_weight[tid][0];
+#endif
+
+            for (int j = 0; j < n_dims; ++j)
+            {
+                stats_per_thread[tid][0][j] += w * tmp_slice[j];
+                stats_per_thread[tid][1][j] += w * tmp_slice[j] * tmp_slice[j];
+            }
+        }
+        barrier_wait(&kmeans_barr);
+
+        if (tid == 0)
+        {
+            for (int j = 0; j < n_dims; ++j)
+            {
+                attr_sum[d + j] = 0;
+                attr_sumsq[d + j] = 0;
+                for (int t = 0; t < NR_TASKLETS; ++t)
+                {
+                    attr_sum[d + j] += stats_per_thread[t][0][j];
+                    attr_sumsq[d + j] += stats_per_thread[t][1][j];
+                }
+            }
+        }
+        barrier_wait(&kmeans_barr);
+    }
+}
+
+void
+zscore_transform(int tid)
+{
+    __dma_aligned float tmp_point[NUM_ATTRIBUTES];
+
+    for (int i = tid; i < n_objects; i += NR_TASKLETS)
+    {
+        mram_read(&attributes[i * NUM_ATTRIBUTES], tmp_point, sizeof(tmp_point));
+
+        for (int j = 0; j < NUM_ATTRIBUTES; ++j)
+        {
+            tmp_point[j] = (tmp_point[j] - attr_mean[j]) * attr_scale[j];
+        }
+
+        mram_write(tmp_point, &attributes[i * NUM_ATTRIBUTES], sizeof(tmp_point));
+    }
+}
+
+void
+bench_assignment(int tid)
+{
+    if (tid == 0)
+    {
+        perfcounter_config(COUNT_CYCLES, true);
+    }
+    barrier_wait(&kmeans_barr);
+
+    for (int blk = 0, n_block; (n_block = load_block(tid, blk)) >= 0; ++blk)
+    {
+        find_nearest_centers(tid, n_block);
+    }
+    barrier_wait(&kmeans_barr);
+
+    /* Cycles of the whole DPU: tasklets share one pipeline */
+    if (tid == 0)
+    {
+        bench_cycles = perfcounter_get();
+    }
+}
+
+// Moves the points of the block nearest to the second center to new_leaf, as
+// one read-modify-write of the words of leaf the block spans
+static void
+store_leaves(int tid, int n_block)
+{
+    int first;
+    int last;
+
+    if (n_block == 0)
+    {
+        return;
+    }
+    first = block_ids[tid][0] & ~1;
+    last = (block_ids[tid][n_block - 1] + 2) & ~1;
+
+    mutex_lock(leaf_mutex);
+    mram_read(&leaf[first], leaf_buf[tid], (last - first) * sizeof(uint32_t));
+    for (int p = 0; p < n_block; ++p)
+    {
+        if (block_index[tid][p] == 1)
+        {
+            leaf_buf[tid][block_ids[tid][p] - first] = new_leaf;
+        }
+    }
+    mram_write(leaf_buf[tid], &leaf[first], (last - first) * sizeof(uint32_t));
+    mutex_unlock(leaf_mutex);
+}
+
+void
+split(int tid)
+{
+    uint32_t weight = 1;
+
+    for (int c = 0; c < 2; ++c)
+    {
+        split_inertia_per_thread[tid][c] = 0;
+        split_count_per_thread[tid][c] = 0;
+    }
+
+    for (int blk = 0, n_block; (n_block = load_block(tid, blk)) >= 0; ++blk)
+    {
+        find_nearest_centers(tid, n_block);
+
+        for (int p = 0; p < n_block; ++p)
+        {
+            int i = block_ids[tid][p];
+            int c = block_index[tid][p];
+
+#if USE_WEIGHTS
+            weight = block_weight[tid][p];
+#endif
+            /* The next fit on either leaf starts from unassigned points */
+            membership[i] = -1;
+
+            split_inertia_per_thread[tid][c] += (double)weight * block_dist[tid][p];
+            split_count_per_thread[tid][c] += weight;
+        }
+        store_leaves(tid, n_block);
+    }
+    barrier_wait(&kmeans_barr);
+
+    if (tid == 0)
+    {
+        for (int c = 0; c < 2; ++c)
+        {
+            split_inertia[c] = 0;
+            split_count[c] = 0;
+            for (int t = 0; t < NR_TASKLETS; ++t)
+            {
+                split_inertia[c] += split_inertia_per_thread[t][c];
+                split_count[c] += split_count_per_thread[t][c];
+            }
+        }
+    }
+}
@@ -14,7 +14,7 @@
     }
 
 #define STORE(t, addr, val)                                                              \
-    TxStore(t, (intptr_t *)addr, (intptr_t)val);                                         \
+    TxStore(t, (volatile TYPE_ACC intptr_t *)(addr), (intptr_t)val);                     \
     if ((t)->status == 4)                                                                \
     {                                                                                    \
         continue;                                                                        \
@@ -28,7 +28,7 @@
     }
 
 #define STORE_LOOP(t, addr, val)                                                         \
-    TxStore(t, (intptr_t *)addr, (intptr_t)val);                                         \
+    TxStore(t, (volatile TYPE_ACC intptr_t *)(addr), (intptr_t)val);                     \
     if ((t)->status == 4)                                                                \
     {                                                                                    \
         break;                                                                           \
@@ -38,4 +38,16 @@ intp2double(intptr_t val)
     return convert.d;
 }
 
+/* mram_read is limited to 2048 bytes per DMA */
+static inline void
+mram_read_large(__mram_ptr void const *from, void *to, unsigned int nb_of_bytes)
+{
+    for (unsigned int off = 0; off < nb_of_bytes; off += 2048)
+    {
+        unsigned int size = (nb_of_bytes - off < 2048) ? nb_of_bytes - off : 2048;
+
+        mram_read((__mram_ptr uint8_t const *)from + off, (uint8_t *)to + off, size);
+    }
+}
+
 #endif /* _UTIL_H_ */
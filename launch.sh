@@ -1,5 +1,5 @@
 #!/bin/bash
-echo -e "N_THREADS_DPU\tN_DPUS\tN_LOOPS\tN_TANSACTIONS\tCOMM_TIME\tTOTAL_TIME" > results.txt
+echo -e "N_THREADS_DPU\tN_DPUS\tN_LOOPS\tN_TANSACTIONS\tCOMM_TIME\tTOTAL_TIME\tINERTIA\tCM_POLICY\tABORTS\tLAUNCH_P50\tLAUNCH_P99\tLAUNCH_MAX" > results.txt
 
 DPUS="1 500 1000 1500 2000 2500"
 
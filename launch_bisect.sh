@@ -0,0 +1,21 @@
+#!/bin/bash
+# Bisecting against flat k-means at the same K: inertia and fit time
+CLUSTERS="16 64 256"
+NUM_DPUS=64
+
+> results_bisect.txt
+
+for k in $CLUSTERS; do
+	make clean
+	make test NUM_DPUS=$NUM_DPUS MIN_N_CLUSTERS=$k MAX_N_CLUSTERS=$k N_CLUSTERS=$k \
+		CENTERS_IN_MRAM=1 ACC_IN_MRAM=1
+
+	for (( j = 0; j < 3; j++ )); do
+		./host/host -k $k >> results_bisect.txt 2>&1
+	done
+done
+
+# Beyond what flat k-means can hold: the kernel only ever sees two centers
+make clean
+make test NUM_DPUS=$NUM_DPUS MIN_N_CLUSTERS=2 MAX_N_CLUSTERS=2 N_CLUSTERS=2
+./host/host -k 4096 >> results_bisect.txt 2>&1
@@ -0,0 +1,10 @@
+#!/bin/bash
+# Host buffers, nested vectors against the arena, for growing DPU counts.
+# Reserve hugepages first (echo N > /proc/sys/vm/nr_hugepages) to measure them
+echo -e "BUFFERS\tN_DPUS\tBYTES\tHUGEPAGES\tALLOC_TIME\tPAGE_FAULTS\tREDUCE_MBPS" > results_buffers.txt
+
+for NUM_DPUS in 64 512 2048; do
+	make clean
+	make test NUM_DPUS=$NUM_DPUS
+	./host/host -A | tail -n +2 >> results_buffers.txt
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Tail launch time of each contention manager under high tasklet counts
+echo -e "N_THREADS_DPU\tN_DPUS\tN_LOOPS\tN_TANSACTIONS\tCOMM_TIME\tTOTAL_TIME\tINERTIA\tCM_POLICY\tABORTS\tLAUNCH_P50\tLAUNCH_P99\tLAUNCH_MAX" > results_cm.txt
+
+TASKLETS="16 20 24"
+POLICIES="0 1 2 3"
+NUM_DPUS=64
+
+for t in $TASKLETS; do
+	make clean
+	make test NUM_DPUS=$NUM_DPUS NR_TASKLETS=$t
+
+	for c in $POLICIES; do
+		for (( j = 0; j < 5; j++ )); do
+			./host/host -c $c >> results_cm.txt
+		done
+	done
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Assignment cycles per point-center pair of each distance kernel
+> results_distance.txt
+
+DIMS="2 8 16 32"
+CLUSTERS="4 16"
+NUM_DPUS=64
+
+for d in $DIMS; do
+	for k in $CLUSTERS; do
+		make clean
+		make test NUM_DPUS=$NUM_DPUS NUM_ATTRIBUTES=$d MIN_N_CLUSTERS=$k MAX_N_CLUSTERS=$k \
+			N_CLUSTERS=$k
+
+		echo "# NUM_ATTRIBUTES=$d N_CLUSTERS=$k" >> results_distance.txt
+		./host/host -B >> results_distance.txt
+	done
+done
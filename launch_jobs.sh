@@ -0,0 +1,16 @@
+#!/bin/bash
+# Many small fits sharing one allocation: jobs/hour, concurrent against the
+# same queue run back to back on the same ranks (-S)
+NUM_DPUS=512
+JOBS=32
+
+make clean
+make test NUM_DPUS=$NUM_DPUS NUM_OBJECTS_PER_DPU=20000
+
+# "n_ranks n_clusters [points_file]", one or two ranks per job
+> jobs.txt
+for (( j = 0; j < JOBS; j++ )); do
+	echo "$(( j % 2 + 1 )) 15" >> jobs.txt
+done
+
+./host/host -j jobs.txt -S > results_jobs.txt
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Per-iteration cost of the MRAM placement against the all-WRAM layout
+echo -e "LAYOUT\tK\tD\tN_THREADS_DPU\tN_DPUS\tN_LOOPS\tN_TANSACTIONS\tCOMM_TIME\tTOTAL_TIME\tINERTIA\tCM_POLICY\tABORTS\tLAUNCH_P50\tLAUNCH_P99\tLAUNCH_MAX" > results_layout.txt
+
+# k:d:points_block:centers_tile. Both layouts of a shape share the block and
+# tile sizes, so only the placement differs. At 256:128 the points and center
+# tiles of 11 tasklets must fit next to the MRAM layout's WRAM state, hence
+# the smaller values; the WRAM layout is expected to fail to link there
+SHAPES="15:16:4:4 256:128:1:2"
+LAYOUTS="wram:0:0:0 mram:1:1:1"
+NUM_DPUS=64
+
+for shape in $SHAPES; do
+	IFS=: read k d block tile <<< "$shape"
+
+	for layout in $LAYOUTS; do
+		IFS=: read name tx acc centers <<< "$layout"
+
+		make clean
+		if ! make test NUM_DPUS=$NUM_DPUS NUM_ATTRIBUTES=$d MIN_N_CLUSTERS=$k \
+			MAX_N_CLUSTERS=$k N_CLUSTERS=$k TX_IN_MRAM=$tx ACC_IN_MRAM=$acc \
+			CENTERS_IN_MRAM=$centers POINTS_BLOCK=$block CENTERS_TILE=$tile; then
+			echo -e "$name\t$k\t$d\tBUILD_FAILED" >> results_layout.txt
+			continue
+		fi
+
+		echo -ne "$name\t$k\t$d\t" >> results_layout.txt
+		./host/host >> results_layout.txt
+	done
+done
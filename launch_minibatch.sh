@@ -0,0 +1,17 @@
+#!/bin/bash
+# Time to reach a target inertia, full batch against mini-batch fractions
+# usage: ./launch_minibatch.sh <target_inertia>
+TARGET=${1:?target inertia}
+FRACTIONS="1 0.1 0.05 0.01"
+NUM_DPUS=512
+
+> results_minibatch.txt
+
+make clean
+make test NUM_DPUS=$NUM_DPUS
+
+for f in $FRACTIONS; do
+	for (( j = 0; j < 3; j++ )); do
+		./host/host -m $f -t $TARGET 2>> results_minibatch.txt > /dev/null
+	done
+done
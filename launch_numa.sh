@@ -0,0 +1,15 @@
+#!/bin/bash
+# Upload bandwidth and iteration time, flat allocation against NUMA aware
+DPUS="512 1024 2048"
+
+> results_numa.txt
+
+for p in $DPUS; do
+	make clean
+	make test NUM_DPUS=$p
+
+	for (( j = 0; j < 3; j++ )); do
+		./host/host 2>> results_numa.txt > /dev/null
+		./host/host -n 2>> results_numa.txt > /dev/null
+	done
+done
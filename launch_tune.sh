@@ -0,0 +1,19 @@
+#!/bin/bash
+# Calibrates the shape once, then builds and runs the chosen configuration.
+# NUM_OBJECTS_PER_DPU must let the points fit on the fewest DPUs worth trying
+NUM_DPUS=2048
+NUM_OBJECTS_PER_DPU=100000
+N_POINTS=20000000
+
+make clean
+make test NUM_DPUS=$NUM_DPUS NUM_OBJECTS_PER_DPU=$NUM_OBJECTS_PER_DPU
+make tune NUM_DPUS=$NUM_DPUS NUM_OBJECTS_PER_DPU=$NUM_OBJECTS_PER_DPU
+
+./host/host -T $N_POINTS | tee results_tune.txt
+
+# Last line: "# best: make test NR_TASKLETS=.. POINTS_BLOCK=.. NUM_DPUS=.. (..)"
+CHOICE=$(tail -n 1 results_tune.txt | sed -e 's/^# [a-z]*: make test //' -e 's/ (.*//')
+
+make clean
+make test $CHOICE NUM_OBJECTS_PER_DPU=$(( N_POINTS / $(echo $CHOICE | sed 's/.*NUM_DPUS=//') + 1 ))
+./host/host >> results_tune.txt
@@ -0,0 +1,13 @@
+#ifndef _CM_H_
+#define _CM_H_
+
+/* Contention managers, applied by TxAbort (build: CM_POLICY, run: cm_policy) */
+enum
+{
+    CM_FIXED = 0,       /* Small random stall after 3 retries */
+    CM_EXPONENTIAL = 1, /* Random stall in a window doubling per retry, capped */
+    CM_ADAPTIVE = 2,    /* Stall window scaled by the recent abort rate */
+    CM_IRREVOCABLE = 3, /* CM_FIXED, then serial under LOCK after N aborts */
+};
+
+#endif /* _CM_H_ */
@@ -22,6 +22,13 @@ enum
 
 volatile long *LOCK;
 
+/* Run-time choice of contention manager, the host may overwrite both */
+__host uint64_t cm_policy = CM_POLICY;
+__host uint64_t cm_irrevocable_after = CM_IRREVOCABLE_AFTER;
+
+#define CM_EXP_MIN 16   /* TUNABLE: first stall window */
+#define CM_EXP_MAX 4096 /* TUNABLE: stall window cap */
+
 // --------------------------------------------------------------
 
 static inline unsigned long long
@@ -55,31 +62,70 @@ TSRandom(TYPE Thread *Self)
 }
 
 static inline void
-backoff(TYPE Thread *Self, long attempt)
+stall(unsigned long long n)
 {
-    unsigned long long stall = TSRandom(Self) & 0xF;
-    stall += attempt >> 2;
-    stall *= 10;
-
-    // stall = stall << attempt;
     /* CCM: timer function may misbehave */
     volatile unsigned long long i = 0;
-    while (i++ < stall)
+    while (i++ < n)
     {
         PAUSE();
     }
 }
 
+static inline void
+backoff(TYPE Thread *Self, long attempt)
+{
+    unsigned long long n = TSRandom(Self) & 0xF;
+    n += attempt >> 2;
+    n *= 10;
+
+    stall(n);
+}
+
+static inline void
+exponential_backoff(TYPE Thread *Self, long attempt)
+{
+    unsigned long long window = CM_EXP_MIN;
+
+    while (attempt-- > 1 && window < CM_EXP_MAX)
+    {
+        window <<= 1;
+    }
+
+    stall(TSRandom(Self) & (window - 1));
+}
+
+static inline void
+adaptive_backoff(TYPE Thread *Self)
+{
+    /* Tasklets that rarely abort retry at once, hot ones spread out */
+    unsigned long long window = CM_EXP_MIN + ((Self->AbortRate * CM_EXP_MAX) >> 10);
+
+    stall(TSRandom(Self) % window);
+}
+
 void
 TxAbort(TYPE Thread *Self)
 {
     Self->Aborts++;
+    Self->Retries++;
+    Self->AbortRate += (1024 - Self->AbortRate) >> 4;
 
 #ifdef BACKOFF
-    Self->Retries++;
-    if (Self->Retries > 3)
-    { /* TUNABLE */
-        backoff(Self, Self->Retries);
+    switch (cm_policy)
+    {
+    case CM_EXPONENTIAL:
+        exponential_backoff(Self, Self->Retries);
+        break;
+    case CM_ADAPTIVE:
+        adaptive_backoff(Self);
+        break;
+    default:
+        if (Self->Retries > 3)
+        { /* TUNABLE */
+            backoff(Self, Self->Retries);
+        }
+        break;
     }
 #endif
 
@@ -92,7 +138,17 @@ TxAbort(TYPE Thread *Self)
 void
 TxInit(TYPE Thread *t, int id)
 {
+#ifdef TX_IN_MRAM
+    /* memset cannot address MRAM, clear what txReset does not */
+    t->Retries = 0;
+    t->snapshot = 0;
+    t->status = 0;
+    t->AbortRate = 0;
+    t->Irrevocable = 0;
+    t->Irrevocables = 0;
+#else
     memset(t, 0, sizeof(*t)); /* Default value for most members */
+#endif
 
     t->UniqID = id;
     t->rng = id + 1;
@@ -117,6 +173,28 @@ txReset(TYPE Thread *Self)
     Self->status = TX_ACTIVE;
 }
 
+// Takes LOCK for the whole transaction: other writers and validating readers
+// wait while it is odd, so this attempt cannot abort
+static inline void
+txStartIrrevocable(TYPE Thread *Self)
+{
+    while (1)
+    {
+        acquire(LOCK);
+        Self->snapshot = *LOCK;
+        if ((Self->snapshot & 1) == 0)
+        {
+            *LOCK = Self->snapshot + 1;
+            release(LOCK);
+            break;
+        }
+        release(LOCK);
+    }
+
+    Self->Irrevocable = 1;
+    Self->Irrevocables++;
+}
+
 void
 TxStart(TYPE Thread *Self)
 {
@@ -126,6 +204,12 @@ TxStart(TYPE Thread *Self)
 
     Self->Starts++;
 
+    if (cm_policy == CM_IRREVOCABLE && Self->Retries >= cm_irrevocable_after)
+    {
+        txStartIrrevocable(Self);
+        return;
+    }
+
     do
     {
         Self->snapshot = *LOCK;
@@ -190,6 +274,11 @@ TxLoad(TYPE Thread *Self, volatile TYPE_ACC intptr_t *Addr)
 
     MEMBARLDLD();
     Valu = LDNF(Addr);
+    if (Self->Irrevocable)
+    {
+        return Valu;
+    }
+
     while (*LOCK != Self->snapshot)
     {
         long newSnap = ReadSetCoherent(Self);
@@ -245,6 +334,8 @@ txCommitReset(TYPE Thread *Self)
 {
     txReset(Self);
     Self->Retries = 0;
+    Self->Irrevocable = 0;
+    Self->AbortRate -= Self->AbortRate >> 4;
 
     Self->status = TX_COMMITTED;
 }
@@ -300,6 +391,19 @@ acquire:
 int
 TxCommit(TYPE Thread *Self)
 {
+    if (Self->Irrevocable)
+    {
+        WriteBackForward(Self);
+
+        MEMBARSTST();
+        *LOCK = Self->snapshot + 2;
+        MEMBARSTLD();
+
+        txCommitReset(Self);
+
+        return 1;
+    }
+
     /* Fast-path: Optional optimization for pure-readers */
     if (Self->wrSet.nb_entries == 0)
     {
@@ -1,8 +1,19 @@
 #ifndef _NOREC_H_
 #define _NOREC_H_
 
+#include <attributes.h>
 #include <stdint.h>
 
+#include "cm.h"
+
+#ifndef CM_POLICY
+#define CM_POLICY CM_FIXED
+#endif
+
+#ifndef CM_IRREVOCABLE_AFTER
+#define CM_IRREVOCABLE_AFTER 8
+#endif
+
 #ifdef TX_IN_MRAM
 #define TYPE __mram_ptr
 #else
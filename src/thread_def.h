@@ -3,8 +3,12 @@
 
 #include <perfcounter.h>
 
+#ifndef R_SET_SIZE
 #define R_SET_SIZE 17 /* Initial size of read sets */
+#endif
+#ifndef W_SET_SIZE
 #define W_SET_SIZE 17 /* Initial size of write sets */
+#endif
 
 typedef int BitMap;
 
@@ -45,9 +49,12 @@ struct _Thread
     volatile long Retries;
     long snapshot;
     long status;
+    long AbortRate; /* Recent aborts per 1024 attempts (CM_ADAPTIVE) */
+    int Irrevocable;
     int UniqID;
     uint32_t Starts;
-    uint32_t Aborts; /* Tally of # of aborts */
+    uint32_t Aborts;       /* Tally of # of aborts */
+    uint32_t Irrevocables; /* Tally of # of serial executions */
 };
 
 #endif